@@ -0,0 +1,154 @@
+#!/bin/bash
+# Differential check of pipesim against the reference dynamsched: every
+# trace under every config below, comparing the whole report. For each
+# mismatch it prints the first diverging instruction (or section) with the
+# expected and actual lines. Every case also runs pipesim's other ways of
+# reading and stepping through the same trace, which must give exactly the
+# same report as the plain stdin run. Exits 1 if anything differs.
+#
+# usage: golden.sh [pipesim] [dynamsched]
+#
+# dynamsched only handles single-width machines, at most 10 stations per
+# pool and 10 ROB entries, and traces under ~450 instructions; it also
+# needs a newline after the last line, so inputs get one appended.
+# dynamsched also counts the 10-station limit across all four pools.
+
+PIPESIM=$(realpath "${1:-./pipesim}") || exit 1
+DYNAMSCHED=$(realpath "${2:-./dynamsched}") || exit 1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# eff addr, fp adds, fp muls, ints, reorder, fp_add, fp_sub, fp_mul, fp_div
+CONFIGS=(
+    "2 3 3 2 5 2 2 5 10"
+    "1 1 1 1 1 1 1 1 1"
+    "3 3 2 2 10 3 4 8 20"
+    "1 4 2 3 8 1 3 6 15"
+    "3 1 1 1 2 4 4 10 30"
+)
+
+# cases where pipesim already differed from dynamsched before any of the
+# simulator rewrites (the original pipesim.cpp gives the same output); these
+# are reported but do not fail the run, anything else that differs does
+KNOWN=(
+    "alias-400.dat [2 3 3 2 5 2 2 5 10]"
+    "ilp-400.dat [2 3 3 2 5 2 2 5 10]"
+    "alias-100.dat [3 3 2 2 10 3 4 8 20]"
+    "alias-400.dat [3 3 2 2 10 3 4 8 20]"
+    "ilp-100.dat [3 3 2 2 10 3 4 8 20]"
+    "ilp-400.dat [3 3 2 2 10 3 4 8 20]"
+    "trace4.dat [1 4 2 3 8 1 3 6 15]"
+    "chain-100.dat [1 4 2 3 8 1 3 6 15]"
+    "chain-400.dat [1 4 2 3 8 1 3 6 15]"
+    "ilp-100.dat [1 4 2 3 8 1 3 6 15]"
+    "ilp-400.dat [1 4 2 3 8 1 3 6 15]"
+    "alias-400.dat [3 1 1 1 2 4 4 10 30]"
+)
+
+is_known(){
+    local known
+    for known in "${KNOWN[@]}"; do
+        [ "$known" = "$1" ] && return 0
+    done
+    return 1
+}
+
+TRACES=(trace*.dat)
+for workload in fpdiv alias chain ilp; do
+    for count in 100 400; do
+        "$PIPESIM" generate $workload $count 1 > "$WORK/$workload-$count.dat" || exit 1
+        TRACES+=("$WORK/$workload-$count.dat")
+    done
+done
+
+write_config(){
+    set -- $1
+    printf 'buffers\n\neff addr: %s\nfp adds: %s\nfp muls: %s\nints: %s\nreorder: %s\n\n' $1 $2 $3 $4 $5
+    printf 'latencies\n\nfp_add: %s\nfp_sub: %s\nfp_mul: %s\nfp_div: %s\n' $6 $7 $8 $9
+}
+
+# first differing line, named by pipeline table row when it is in the table
+report_divergence(){
+    awk -v expected="$1" -v actual="$2" '
+        BEGIN {
+            while((getline e < expected) > 0){
+                n++
+                if((getline a < actual) <= 0) a = "<end of output>"
+                if(e ~ /^-+ -+ /){ table = n; continue }
+                if(table && e == "") table = 0
+                if(e != a) break
+            }
+            if(e == a){
+                if((getline a < actual) > 0){ n++; e = "<end of output>" }
+                else exit
+            }
+            if(table) printf "  first divergence at instruction %d\n", n - table
+            else printf "  first divergence at line %d\n", n
+            printf "    dynamsched: %s\n    pipesim:    %s\n", e, a
+        }'
+}
+
+# the other ways pipesim can run a case; each must match the stdin run
+# (the <(...) ones hand --trace a pipe, which can't be mapped)
+VARIANTS=(
+    "--step < input.dat"
+    "--trace input.dat"
+    "--trace input.dat --parse-threads 4"
+    "--decode-thread < input.dat"
+    "< input.bin"
+    "--trace input.bin"
+    "--trace input.bin --decode-thread"
+    "--trace <(cat input.dat)"
+    "--trace <(cat input.bin)"
+)
+
+# runs every variant in dir, naming each one that differs from actual.txt
+check_variants(){
+    local variant different=0
+    (cd "$1" && "$PIPESIM" convert input.dat input.bin) || different=1
+    for variant in "${VARIANTS[@]}"; do
+        (cd "$1" && eval timeout 10 '"$PIPESIM"' $variant > variant.txt 2>&1)
+        if ! cmp -s "$1/actual.txt" "$1/variant.txt"; then
+            echo "  pipesim $variant differs from the stdin run"
+            different=1
+        fi
+    done
+    return $different
+}
+
+cases=0
+failures=0
+known=0
+variant_failures=0
+for config in "${CONFIGS[@]}"; do
+    dir="$WORK/config-${config// /-}"
+    mkdir -p "$dir"
+    write_config "$config" > "$dir/config.txt"
+    for trace in "${TRACES[@]}"; do
+        cases=$((cases + 1))
+        awk 1 "$trace" > "$dir/input.dat"
+        (cd "$dir" && timeout 10 "$DYNAMSCHED" < input.dat > expected.txt 2>&1)
+        (cd "$dir" && timeout 10 "$PIPESIM" < input.dat > actual.txt 2>&1)
+        name="$(basename "$trace") [$config]"
+        if cmp -s "$dir/expected.txt" "$dir/actual.txt"; then
+            is_known "$name" && echo "now matching, drop from KNOWN: $name"
+        elif is_known "$name"; then
+            known=$((known + 1))
+            echo "known $name"
+            report_divergence "$dir/expected.txt" "$dir/actual.txt"
+        else
+            failures=$((failures + 1))
+            echo "DIFF $name"
+            report_divergence "$dir/expected.txt" "$dir/actual.txt"
+        fi
+        if ! check_variants "$dir" > "$dir/variants.txt"; then
+            variant_failures=$((variant_failures + 1))
+            echo "VARIANT $name"
+            cat "$dir/variants.txt"
+        fi
+    done
+done
+
+echo "$((cases - failures - known)) of $cases cases match dynamsched ($known known differences, $failures new)"
+echo "$((cases - variant_failures)) of $cases cases give the same report every way pipesim runs them"
+[ $failures = 0 ] && [ $variant_failures = 0 ]
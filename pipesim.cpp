@@ -2,14 +2,48 @@
 #include <fstream>
 #include <sstream>
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <climits>
 #include <vector>
+#include <queue>
 #include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sys/wait.h>
+#include <sys/resource.h>
 using namespace std;
 
-#define LINESIZE 80
-#define MAXLINES 500
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// architectural registers: x0-x31 are 0-31 and f0-f31 are 32-63
+#define NUM_REGS 64
+#define NO_REG -1
+
+// ROB tags are 16 bits with -1 for "none"
+#define MAX_ROB_ENTRIES 32767
+
+// the other config limits: well past any useful machine, and small enough
+// that station totals and cycle + latency can't overflow an int
+#define MAX_STATIONS 32767      // per pool
+#define MAX_LATENCY 100000
+#define MAX_WIDTH 32767
+
+// issue to commit latencies counted one by one for --stats, longer ones share the last bucket
+#define LATENCY_BUCKETS 64
 
 
 struct Config {
@@ -23,103 +57,881 @@ struct Config {
     int fp_sub_latency;
     int fp_mul_latency;
     int fp_div_latency;
+
+    // per-cycle limits, all 1 unless config.txt has a widths section
+    int issue_width;
+    int cdb_count;
+    int commit_width;
+    int mem_ports;
+};
+
+enum InstrType {
+    LOAD, STORE, FP_ADD, FP_SUB, FP_MUL, FP_DIV, INT_ADD, INT_SUB, BRANCH, UNKNOWN,
+    NUM_INSTR_TYPES
+};
+
+enum StationClass {
+    EFF_ADDR_RS, FP_ADD_RS, FP_MUL_RS, INT_RS,
+    NUM_STATION_CLASSES,
+    NO_RS = NUM_STATION_CLASSES
+};
+
+// as the buffers are named in config.txt
+const char *station_names[NUM_STATION_CLASSES] = {"eff addr", "fp adds", "fp muls", "ints"};
+
+// Everything the pipeline needs to know about an instruction type, so the
+// stages index this table instead of comparing type strings every cycle.
+struct TypeInfo {
+    const char *name;
+    StationClass station;
+    int Config::*latency;   // nullptr means a fixed latency of 1
+    bool is_load;
+    bool is_store;
+    bool writes_result;     // stores and branches are done after execute and never use the CDB
+};
+
+const TypeInfo instr_types[NUM_INSTR_TYPES] = {
+    // name      station      latency                  load   store  writes_result
+    {"LOAD",    EFF_ADDR_RS, nullptr,                 true,  false, true },
+    {"STORE",   EFF_ADDR_RS, nullptr,                 false, true,  false},
+    {"FP_ADD",  FP_ADD_RS,   &Config::fp_add_latency, false, false, true },
+    {"FP_SUB",  FP_ADD_RS,   &Config::fp_sub_latency, false, false, true },
+    {"FP_MUL",  FP_MUL_RS,   &Config::fp_mul_latency, false, false, true },
+    {"FP_DIV",  FP_MUL_RS,   &Config::fp_div_latency, false, false, true },
+    {"INT_ADD", INT_RS,      nullptr,                 false, false, true },
+    {"INT_SUB", INT_RS,      nullptr,                 false, false, true },
+    {"BRANCH",  INT_RS,      nullptr,                 false, false, false},
+    {"UNKNOWN", NO_RS,       nullptr,                 false, false, false},
+};
+
+// Every opcode a trace line can have, and the type the pipeline treats it
+// as. The report and the stats tell opcodes apart, the stages only types.
+enum Opcode {
+    OP_LW, OP_FLW, OP_SW, OP_FSW, OP_FADD, OP_FSUB, OP_FMUL, OP_FDIV,
+    OP_ADD, OP_SUB, OP_BEQ, OP_BNE, OP_UNKNOWN,
+    NUM_OPCODES
+};
+
+struct OpcodeInfo {
+    const char *name;
+    InstrType type;
+};
+
+const OpcodeInfo opcodes[NUM_OPCODES] = {
+    {"lw", LOAD}, {"flw", LOAD}, {"sw", STORE}, {"fsw", STORE},
+    {"fadd.s", FP_ADD}, {"fsub.s", FP_SUB}, {"fmul.s", FP_MUL}, {"fdiv.s", FP_DIV},
+    {"add", INT_ADD}, {"sub", INT_SUB}, {"beq", BRANCH}, {"bne", BRANCH},
+    {"unknown", UNKNOWN},
 };
 
+// one decoded trace line, as trace sources hand it to the simulator
 struct Instruction {
     string og_line;
-    string type;
-    string opcode;
-    string dest_reg;
-    string src_reg1;
-    string src_reg2;
+    Opcode opcode;
+    InstrType type;     // opcodes[opcode].type
+    int dest_reg;
+    int src_reg1;
+    int src_reg2;
     int memory_address;
+};
 
-    int issue_cycle;
-    int execute_start_cycle;
-    int execute_complete_cycle;
-    int mem_read_cycle;
-    int write_back_cycle;
-    int commit_cycle;
+// switch on the length first so each opcode costs at most a few
+// fixed-size compares
+Opcode get_opcode(const char *op, size_t length) {
+    switch(length){
+        case 2:
+            if(memcmp(op, "lw", 2) == 0) return OP_LW;
+            if(memcmp(op, "sw", 2) == 0) return OP_SW;
+            break;
+        case 3:
+            if(memcmp(op, "flw", 3) == 0) return OP_FLW;
+            if(memcmp(op, "fsw", 3) == 0) return OP_FSW;
+            if(memcmp(op, "add", 3) == 0) return OP_ADD;
+            if(memcmp(op, "sub", 3) == 0) return OP_SUB;
+            if(memcmp(op, "beq", 3) == 0) return OP_BEQ;
+            if(memcmp(op, "bne", 3) == 0) return OP_BNE;
+            break;
+        case 6:
+            if(op[0] != 'f' || memcmp(op + 4, ".s", 2) != 0) break;
+            if(memcmp(op + 1, "add", 3) == 0) return OP_FADD;
+            if(memcmp(op + 1, "sub", 3) == 0) return OP_FSUB;
+            if(memcmp(op + 1, "mul", 3) == 0) return OP_FMUL;
+            if(memcmp(op + 1, "div", 3) == 0) return OP_FDIV;
+            break;
+    }
+    return OP_UNKNOWN;
+}
 
-};
+// the characters trim() used to strip
+inline bool is_blank(char c){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
 
-string get_instruction_type(const string& opcode) {
-    if (opcode == "lw" || opcode == "flw") return "LOAD";
-    if (opcode == "sw" || opcode == "fsw") return "STORE";
-    if (opcode == "fadd.s") return "FP_ADD";
-    if (opcode == "fsub.s") return "FP_SUB";
-    if (opcode == "fmul.s") return "FP_MUL";
-    if (opcode == "fdiv.s") return "FP_DIV";
-    if (opcode == "add") return "INT_ADD";
-    if (opcode == "sub") return "INT_SUB";
-    if (opcode == "beq" || opcode == "bne") return "BRANCH";
-    return "UNKNOWN";
+// isspace() in the C locale, without the locale lookup
+inline bool is_space(char c){
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n");
-    if (first == string::npos) return "";
-    size_t last = str.find_last_not_of(" \t\r\n");
-    return str.substr(first, (last - first + 1));
+// The register operand in text[pos, pos + n), clamped to length the way
+// string::substr clamps, with blanks around it ignored.
+// "x5" -> 5, "f5" -> 37 and "" -> NO_REG; false for anything else
+bool parse_register(const char *text, size_t length, size_t pos, size_t n, int &reg){
+    if(pos > length) pos = length;
+    size_t end = n < length - pos ? pos + n : length;
+    while(pos < end && is_blank(text[pos])) pos++;
+    while(end > pos && is_blank(text[end - 1])) end--;
+    if(pos == end){
+        reg = NO_REG;
+        return true;
+    }
+    if(end - pos < 2 || end - pos > 3 || (text[pos] != 'x' && text[pos] != 'f')) return false;
+    int num = 0;
+    for(size_t i = pos + 1; i < end; i++){
+        if(text[i] < '0' || text[i] > '9') return false;
+        num = num * 10 + (text[i] - '0');
+    }
+    if(num > 31) return false;
+    reg = (text[pos] == 'f' ? 32 : 0) + num;
+    return true;
+}
+
+// leading blanks, optional sign, then digits up to the first non-digit,
+// like stoi; false if there are no digits or the value overflows an int
+bool parse_address(const char *s, const char *end, int &value){
+    while(s < end && is_space(*s)) s++;
+    bool negative = false;
+    if(s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    if(s == end || *s < '0' || *s > '9') return false;
+    long long v = 0;
+    while(s < end && *s >= '0' && *s <= '9'){
+        v = v * 10 + (*s++ - '0');
+        if(v > (long long)INT_MAX + 1) return false;
+    }
+    if(negative) v = -v;
+    if(v > INT_MAX) return false;
+    value = v;
+    return true;
+}
+
+// Fills inst from one trace line in a single pass over the raw characters,
+// without allocating. Returns nullptr, or what is wrong with the line.
+//
+//   lw   x2,34(x1):1    loads: dest, base in parens, address after ':'
+//   sw   x2,34(x1):1    stores: data register, base in parens
+//   beq  x1,x2,label    branches: two sources, the label is ignored
+//   add  x1,x2,x3       everything else: dest, then two sources
+const char *parse_instruction(const char *line, size_t length, Instruction &inst){
+    inst.og_line.assign(line, length);
+    inst.memory_address = 0;
+
+    const char *end = line + length;
+    const char *opcode = line;
+    while(opcode < end && is_space(*opcode)) opcode++;
+    const char *rest = opcode;
+    while(rest < end && !is_space(*rest)) rest++;
+    inst.opcode = get_opcode(opcode, rest - opcode);
+    if(inst.opcode == OP_UNKNOWN) return "unknown opcode";
+    inst.type = opcodes[inst.opcode].type;
+
+    // first '(', ')', ':' and first two commas after the opcode
+    size_t rest_length = end - rest;
+    size_t open_paren = string::npos, close_paren = string::npos, colon = string::npos;
+    size_t c1 = string::npos, c2 = string::npos;
+    for(size_t i = 0; i < rest_length; i++){
+        switch(rest[i]){
+            case '(': if(open_paren == string::npos) open_paren = i; break;
+            case ')': if(close_paren == string::npos) close_paren = i; break;
+            case ':': if(colon == string::npos) colon = i; break;
+            case ',':
+                if(c1 == string::npos) c1 = i;
+                else if(c2 == string::npos) c2 = i;
+                break;
+        }
+    }
+
+    bool ok;
+    if(open_paren != string::npos){
+        if(!parse_address(rest + colon + 1, end, inst.memory_address)) return "invalid address";
+        size_t base_length = close_paren - open_paren - 1;
+        inst.dest_reg = inst.src_reg1 = inst.src_reg2 = NO_REG;
+        if(inst.type == LOAD){
+            ok = parse_register(rest, rest_length, 0, c1, inst.dest_reg) &&
+                 parse_register(rest, rest_length, open_paren + 1, base_length, inst.src_reg1);
+        }
+        else if(inst.type == STORE){
+            ok = parse_register(rest, rest_length, 0, c1, inst.src_reg1) &&
+                 parse_register(rest, rest_length, open_paren + 1, base_length, inst.src_reg2);
+        }
+        else ok = true;
+    }
+    else if(inst.type == BRANCH){
+        inst.dest_reg = NO_REG;
+        ok = parse_register(rest, rest_length, 0, c1, inst.src_reg1) &&
+             parse_register(rest, rest_length, c1 + 1, c2 - c1 - 1, inst.src_reg2);
+    }
+    else {
+        ok = parse_register(rest, rest_length, 0, c1, inst.dest_reg) &&
+             parse_register(rest, rest_length, c1 + 1, c2 - c1 - 1, inst.src_reg1) &&
+             parse_register(rest, rest_length, c2 + 1, string::npos, inst.src_reg2);
+    }
+    if(!ok) return "invalid register";
+    return nullptr;
 }
 
+// Instructions are pulled one at a time as issue() needs them, so the
+// simulator never holds more than a ROB's worth of the trace in memory.
+class TraceSource {
+    public:
+    TraceSource() : error(false) {}
+    virtual ~TraceSource() {}
+    // returns false once the trace is exhausted
+    virtual bool next(Instruction &inst) = 0;
+    // true if the trace stopped early on a line that could not be parsed
+    bool failed() const { return error; }
+
+    protected:
+    bool error;
+};
+
+class StreamTraceSource : public TraceSource {
+    public:
+    StreamTraceSource(istream &in) : in(in) {}
+
+    bool next(Instruction &inst){
+        if(!getline(in, line)) return false;
+        const char *problem = parse_instruction(line.data(), line.size(), inst);
+        if(problem){
+            cerr << line << ": instruction has " << problem << endl;
+            error = true;
+            return false;
+        }
+        return true;
+    }
 
-vector<Instruction> parse_instructions(){
+    private:
+    istream &in;
     string line;
-    vector<Instruction> instructions;
-    while(getline(cin, line)){
-        Instruction inst; 
-        inst.og_line = line;
+};
 
-        istringstream iss(line);
-        iss >> inst.opcode;
+// Binary trace format, written by "pipesim convert" so a trace that is
+// replayed many times only gets parsed once. Host byte order.
+//
+//   8 byte magic, then blocks until end of file:
+//     TraceBlockHeader
+//     record_count TraceRecords
+//     text_bytes bytes holding the original line of every record, padded
+//     to a multiple of 8 so the next block stays aligned in a mapped file
+//
+// The text is kept because the report prints it. Blocks let the converter
+// and the loader work on a bounded amount of memory and read from pipes.
+#define TRACE_MAGIC "\x7fPSTRC2\n"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_BLOCK_RECORDS 4096
+#define TRACE_BLOCK_TEXT_BYTES (1 << 26)
+
+struct TraceBlockHeader {
+    uint32_t record_count;
+    uint32_t text_bytes;
+};
+
+struct TraceRecord {
+    int32_t memory_address;
+    uint32_t text_offset;   // from the start of the block's text
+    uint32_t text_length;
+    uint8_t opcode;         // Opcode, the type follows from it
+    int8_t dest_reg;        // register IDs, NO_REG if unused
+    int8_t src_reg1;
+    int8_t src_reg2;
+};
+
+// within what convert writes, so a loader can size its buffers from it
+bool check_trace_header(const TraceBlockHeader &header){
+    return header.record_count <= TRACE_BLOCK_RECORDS && header.text_bytes <= TRACE_BLOCK_TEXT_BYTES;
+}
+
+bool valid_register(int reg){
+    return reg >= NO_REG && reg < NUM_REGS;
+}
+
+// false if any record has a bad opcode or register or points outside the text
+bool check_trace_block(const TraceBlockHeader &header, const TraceRecord *records){
+    for(uint32_t i = 0; i < header.record_count; i++){
+        const TraceRecord &rec = records[i];
+        if(rec.opcode >= OP_UNKNOWN || !valid_register(rec.dest_reg) ||
+           !valid_register(rec.src_reg1) || !valid_register(rec.src_reg2) ||
+           rec.text_offset > header.text_bytes ||
+           rec.text_length > header.text_bytes - rec.text_offset){
+            return false;
+        }
+    }
+    return true;
+}
+
+void decode_trace_record(const TraceRecord &rec, const char *text, Instruction &inst){
+    inst.og_line.assign(text + rec.text_offset, rec.text_length);
+    inst.opcode = (Opcode)rec.opcode;
+    inst.type = opcodes[inst.opcode].type;
+    inst.dest_reg = rec.dest_reg;
+    inst.src_reg1 = rec.src_reg1;
+    inst.src_reg2 = rec.src_reg2;
+    inst.memory_address = rec.memory_address;
+}
+
+class BinaryTraceSource : public TraceSource {
+    public:
+    // the magic has already been checked and consumed
+    BinaryTraceSource(istream &in) : in(in), pos(0) {}
 
-        inst.type = get_instruction_type(inst.opcode);
+    bool next(Instruction &inst){
+        if(pos == records.size() && !read_block()) return false;
+        decode_trace_record(records[pos++], text.data(), inst);
+        return true;
+    }
+
+    private:
+    bool read_block(){
+        TraceBlockHeader header;
+        if(!in.read((char *)&header, sizeof(header))){
+            if(in.gcount() == 0) return false;
+            return corrupt();
+        }
+        if(!check_trace_header(header)) return corrupt();
+        records.resize(header.record_count);
+        text.resize(header.text_bytes);
+        if(!in.read((char *)records.data(), header.record_count * sizeof(TraceRecord)) ||
+           !in.read(&text[0], header.text_bytes) ||
+           !check_trace_block(header, records.data())){
+            return corrupt();
+        }
+        pos = 0;
+        return !records.empty();
+    }
 
-        string rest_of_line;
-        getline(iss, rest_of_line);
-        if(rest_of_line.find('(') != string::npos){
-            size_t c = rest_of_line.find(',');
-            size_t open_paren = rest_of_line.find('(');
-            size_t close_paren = rest_of_line.find(')');
-            size_t colon = rest_of_line.find(':');
-            inst.memory_address = stoi(rest_of_line.substr(colon +1));
+    bool corrupt(){
+        cerr << "binary trace is truncated or corrupt" << endl;
+        error = true;
+        records.clear();
+        pos = 0;
+        return false;
+    }
 
-            if(inst.type == "LOAD"){
-                inst.dest_reg = trim(rest_of_line.substr(0, c));
-                inst.src_reg1 = trim(rest_of_line.substr(open_paren + 1, close_paren - open_paren -1));
-                inst.src_reg2 = "";
+    istream &in;
+    vector<TraceRecord> records;
+    string text;
+    size_t pos;
+};
+
+// picks the parser by looking for the binary trace magic
+TraceSource *open_trace(istream &in){
+    if(in.peek() != TRACE_MAGIC[0]) return new StreamTraceSource(in);
+    char magic[TRACE_MAGIC_SIZE];
+    if(!in.read(magic, TRACE_MAGIC_SIZE) || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0){
+        cerr << "unrecognized binary trace format" << endl;
+        return nullptr;
+    }
+    return new BinaryTraceSource(in);
+}
+
+// A trace file mapped read-only, so it is parsed straight out of the page
+// cache with no copy through iostream buffers, and concurrent simulator
+// processes on the same trace share its pages.
+class MappedFile {
+    public:
+    MappedFile() : data(nullptr), size(0) {}
+    ~MappedFile(){
+        if(size) munmap((void *)data, size);
+    }
+
+    // false (with a message) if the file can't be opened or mapped
+    bool open(const string &filename){
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0){
+            cerr << "can't open trace: " << filename << endl;
+            return false;
+        }
+        struct stat st;
+        // a pipe or device has no size to map, and would look like an empty trace
+        bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        if(ok && st.st_size > 0){
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = p != MAP_FAILED;
+            if(ok){
+                data = (const char *)p;
+                size = st.st_size;
+                madvise(p, size, MADV_SEQUENTIAL);
             }
-            else if(inst.type == "STORE"){
-                inst.dest_reg = "";
-                inst.src_reg1 = trim(rest_of_line.substr(0, c));
-                inst.src_reg2 = trim(rest_of_line.substr(open_paren + 1, close_paren - open_paren -1));
+        }
+        close(fd);
+        if(!ok) cerr << "can't map trace: " << filename << endl;
+        return ok;
+    }
+
+    const char *data;
+    size_t size;
+
+    private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+// text trace lines found in place in the mapping, same splitting as getline
+class MappedTextTraceSource : public TraceSource {
+    public:
+    MappedTextTraceSource(MappedFile *file) : file(file), pos(0) {}
+
+    bool next(Instruction &inst){
+        if(pos >= file->size) return false;
+        const char *start = file->data + pos;
+        const char *newline = (const char *)memchr(start, '\n', file->size - pos);
+        size_t length = newline ? newline - start : file->size - pos;
+        pos += length + 1;
+        const char *problem = parse_instruction(start, length, inst);
+        if(problem){
+            cerr.write(start, length) << ": instruction has " << problem << endl;
+            error = true;
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    unique_ptr<MappedFile> file;
+    size_t pos;
+};
+
+// binary trace records read in place in the mapping, a block at a time
+class MappedBinaryTraceSource : public TraceSource {
+    public:
+    MappedBinaryTraceSource(MappedFile *file) : file(file), pos(TRACE_MAGIC_SIZE), records(nullptr), count(0), index(0), text(nullptr) {}
+
+    bool next(Instruction &inst){
+        if(index == count && !next_block()) return false;
+        decode_trace_record(records[index++], text, inst);
+        return true;
+    }
+
+    private:
+    bool next_block(){
+        if(pos == file->size) return false;
+        TraceBlockHeader header;
+        if(file->size - pos < sizeof(header)) return corrupt();
+        memcpy(&header, file->data + pos, sizeof(header));
+        pos += sizeof(header);
+        if(!check_trace_header(header)) return corrupt();
+        size_t record_bytes = (size_t)header.record_count * sizeof(TraceRecord);
+        if(file->size - pos < record_bytes || file->size - pos - record_bytes < header.text_bytes) return corrupt();
+        records = (const TraceRecord *)(file->data + pos);
+        text = file->data + pos + record_bytes;
+        pos += record_bytes + header.text_bytes;
+        if(pos % 8 != 0 || !check_trace_block(header, records)) return corrupt();
+        count = header.record_count;
+        index = 0;
+        return count > 0;
+    }
+
+    bool corrupt(){
+        cerr << "binary trace is truncated or corrupt" << endl;
+        error = true;
+        count = index = 0;
+        pos = file->size;
+        return false;
+    }
+
+    unique_ptr<MappedFile> file;
+    size_t pos;                     // start of the next block
+    const TraceRecord *records;     // current block, pointing into the mapping
+    uint32_t count;
+    uint32_t index;
+    const char *text;
+};
+
+#define PARSE_CHUNK_BYTES (1 << 18)
+#define PARSE_RING_CHUNKS 16
+
+// Parses a mapped text trace on worker threads while the simulator runs.
+// The file is cut into chunks of whole lines that workers claim in file
+// order and parse into a ring of PARSE_RING_CHUNKS slots. next() hands
+// the records out in order, so workers never get more than a ring ahead
+// of the simulator and the parsed records are reused instead of
+// reallocated.
+class ParallelTraceSource : public TraceSource {
+    public:
+    ParallelTraceSource(MappedFile *file, int threads) :
+        file(file), next_offset(0), claimed(0), consumed(0), stopping(false),
+        current(nullptr), index(0), finished(false) {
+        for(int t = 0; t < threads; t++) workers.push_back(thread(&ParallelTraceSource::worker, this));
+    }
+
+    ~ParallelTraceSource(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        slot_free.notify_all();
+        for(thread &t : workers) t.join();
+    }
+
+    bool next(Instruction &inst){
+        while(!current || index == current->count){
+            if(finished) return false;
+            unique_lock<mutex> guard(lock);
+            if(current){
+                if(current->problem){
+                    cerr.write(current->bad_line, current->bad_length) << ": instruction has " << current->problem << endl;
+                    error = true;
+                    finished = true;
+                    return false;
+                }
+                current->ready = false;
+                current = nullptr;
+                consumed++;
+                slot_free.notify_all();
+            }
+            Chunk &chunk = ring[consumed % PARSE_RING_CHUNKS];
+            chunk_ready.wait(guard, [&]{ return chunk.ready || all_consumed(); });
+            if(!chunk.ready){
+                finished = true;
+                return false;
             }
+            current = &chunk;
+            index = 0;
         }
-        else {
-            size_t c1 = rest_of_line.find(',');
-            size_t c2 = rest_of_line.find(',', c1 +1);
-            if(inst.type == "BRANCH"){
-                inst.dest_reg = "";
-                inst.src_reg1 = trim(rest_of_line.substr(0, c1));
-                inst.src_reg2 = trim(rest_of_line.substr(c1 + 1, c2 - c1 - 1));
+        // swap so the string buffers keep circulating between the ring and the ROB
+        swap(inst, current->instrs[index++]);
+        return true;
+    }
+
+    private:
+    struct Chunk {
+        Chunk() : count(0), bad_line(nullptr), bad_length(0), problem(nullptr), ready(false) {}
+        vector<Instruction> instrs;
+        size_t count;           // records parsed before the end or the bad line
+        const char *bad_line;
+        size_t bad_length;
+        const char *problem;    // from parse_instruction, nullptr if every line parsed
+        bool ready;
+    };
+
+    // every chunk has been claimed and handed out; caller holds the lock
+    bool all_consumed() const {
+        return next_offset >= file->size && consumed == claimed;
+    }
+
+    void worker(){
+        unique_lock<mutex> guard(lock);
+        for(;;){
+            slot_free.wait(guard, [&]{
+                return stopping || next_offset >= file->size || claimed < consumed + PARSE_RING_CHUNKS;
+            });
+            if(stopping || next_offset >= file->size) break;
+
+            size_t start = next_offset;
+            size_t end = start + PARSE_CHUNK_BYTES;
+            if(end >= file->size) end = file->size;
+            else {
+                const char *newline = (const char *)memchr(file->data + end, '\n', file->size - end);
+                end = newline ? newline - file->data + 1 : file->size;
+            }
+            next_offset = end;
+            Chunk &chunk = ring[claimed++ % PARSE_RING_CHUNKS];
+            guard.unlock();
+
+            parse_chunk(chunk, start, end);
+
+            guard.lock();
+            chunk.ready = true;
+            chunk_ready.notify_all();
+        }
+        // wake the reader in case it is waiting on a chunk that won't come
+        chunk_ready.notify_all();
+    }
+
+    // same line splitting as MappedTextTraceSource
+    void parse_chunk(Chunk &chunk, size_t pos, size_t end){
+        chunk.count = 0;
+        chunk.problem = nullptr;
+        while(pos < end){
+            const char *start = file->data + pos;
+            const char *newline = (const char *)memchr(start, '\n', end - pos);
+            size_t length = newline ? newline - start : end - pos;
+            pos += length + 1;
+            if(chunk.count == chunk.instrs.size()) chunk.instrs.emplace_back();
+            chunk.problem = parse_instruction(start, length, chunk.instrs[chunk.count]);
+            if(chunk.problem){
+                chunk.bad_line = start;
+                chunk.bad_length = length;
+                return;
+            }
+            chunk.count++;
+        }
+    }
+
+    unique_ptr<MappedFile> file;
+    vector<thread> workers;
+
+    // shared with the workers, guarded by lock
+    mutex lock;
+    condition_variable chunk_ready;
+    condition_variable slot_free;
+    size_t next_offset;     // start of the first unclaimed chunk
+    long long claimed;      // chunks handed to workers so far
+    long long consumed;     // chunks the simulator is done with
+    bool stopping;
+    Chunk ring[PARSE_RING_CHUNKS];
+
+    // reader only
+    Chunk *current;
+    size_t index;
+    bool finished;
+};
+
+#define DECODE_RING_SIZE 1024   // must be a power of two
+
+// Runs another source on a decoder thread so decoding overlaps with
+// simulation. The two threads share a lock-free single-producer,
+// single-consumer ring: the decoder only writes head, the simulator only
+// writes tail, and each side backs off while the ring is full or empty.
+// Memory stays bounded however long the input is.
+class DecodeThreadTraceSource : public TraceSource {
+    public:
+    DecodeThreadTraceSource(TraceSource *inner) :
+        inner(inner), ring(DECODE_RING_SIZE), head(0), tail(0), done(false), stopping(false) {
+        decoder = thread(&DecodeThreadTraceSource::decode, this);
+    }
+
+    ~DecodeThreadTraceSource(){
+        stopping.store(true);
+        decoder.join();
+    }
+
+    bool next(Instruction &inst){
+        size_t t = tail.load(memory_order_relaxed);
+        for(int spins = 0; head.load(memory_order_acquire) == t; spins++){
+            if(done.load(memory_order_acquire)){
+                // head is published before done, so look once more
+                if(head.load(memory_order_acquire) != t) break;
+                error = inner->failed();
+                return false;
             }
-            else{
-                inst.dest_reg = trim(rest_of_line.substr(0, c1));
-                inst.src_reg1 = trim(rest_of_line.substr(c1 +1, c2 - c1 - 1));
-                inst.src_reg2 = trim(rest_of_line.substr(c2 +1));
+            back_off(spins);
+        }
+        // swap so the string buffers keep circulating between the ring and the ROB
+        swap(inst, ring[t & (DECODE_RING_SIZE - 1)]);
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    private:
+    void decode(){
+        size_t h = 0;
+        for(;;){
+            for(int spins = 0; h - tail.load(memory_order_acquire) == DECODE_RING_SIZE; spins++){
+                if(stopping.load()) return;
+                back_off(spins);
             }
+            if(stopping.load() || !inner->next(ring[h & (DECODE_RING_SIZE - 1)])) break;
+            head.store(++h, memory_order_release);
         }
+        done.store(true, memory_order_release);
+    }
+
+    // yield for a while, then sleep so a waiting side stops burning a
+    // core the other side may need
+    static void back_off(int spins){
+        if(spins < 64) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(50));
+    }
+
+    unique_ptr<TraceSource> inner;     // only touched by the decoder until done
+    vector<Instruction> ring;
+    atomic<size_t> head;                // records decoded so far
+    atomic<size_t> tail;                // records taken by the simulator
+    atomic<bool> done;
+    atomic<bool> stopping;
+    thread decoder;
+};
+
+// A trace file that can't be mapped (a FIFO, /dev/stdin, a process
+// substitution), read through an ifstream with the same parsers as stdin.
+class FileStreamTraceSource : public TraceSource {
+    public:
+    FileStreamTraceSource(TraceSource *inner, ifstream *file) : file(file), inner(inner) {}
+
+    bool next(Instruction &inst){
+        if(inner->next(inst)) return true;
+        error = inner->failed();
+        return false;
+    }
+
+    private:
+    unique_ptr<ifstream> file;          // outlives inner, which reads it
+    unique_ptr<TraceSource> inner;
+};
 
-        inst.issue_cycle = -1;
-        inst.execute_start_cycle = -1;
-        inst.execute_complete_cycle = -1;
-        inst.write_back_cycle = -1;
-        inst.commit_cycle = -1;
-        inst.mem_read_cycle = -1;
-        instructions.push_back(inst);
+TraceSource *open_trace_stream(const string &filename){
+    ifstream *file = new ifstream(filename, ios::binary);
+    if(!file->is_open()){
+        cerr << "can't open trace: " << filename << endl;
+        delete file;
+        return nullptr;
+    }
+    TraceSource *inner = open_trace(*file);
+    if(inner == nullptr){
+        delete file;
+        return nullptr;
     }
-    return instructions;
+    return new FileStreamTraceSource(inner, file);
+}
+
+// --trace FILE: maps the file and picks the parser by its first bytes;
+// text traces are parsed on parse_threads workers if that is above 0.
+// Pipes and devices are streamed instead, on one thread.
+TraceSource *open_trace_file(const string &filename, int parse_threads){
+    struct stat st;
+    if(stat(filename.c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode))){
+        return open_trace_stream(filename);
+    }
+    MappedFile *file = new MappedFile;
+    if(!file->open(filename)){
+        delete file;
+        return nullptr;
+    }
+    if(file->size == 0 || file->data[0] != TRACE_MAGIC[0]){
+        if(parse_threads > 0) return new ParallelTraceSource(file, parse_threads);
+        return new MappedTextTraceSource(file);
+    }
+    if(file->size < TRACE_MAGIC_SIZE || memcmp(file->data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0){
+        cerr << "unrecognized binary trace format" << endl;
+        delete file;
+        return nullptr;
+    }
+    return new MappedBinaryTraceSource(file);
+}
+
+int write_trace_block(FILE *out, vector<TraceRecord> &records, string &text){
+    text.resize((text.size() + 7) & ~(size_t)7, '\0');
+    TraceBlockHeader header;
+    header.record_count = records.size();
+    header.text_bytes = text.size();
+    if(fwrite(&header, sizeof(header), 1, out) != 1 ||
+       fwrite(records.data(), sizeof(TraceRecord), records.size(), out) != records.size() ||
+       fwrite(text.data(), 1, text.size(), out) != text.size()){
+        return -1;
+    }
+    records.clear();
+    text.clear();
+    return 0;
+}
+
+// pipesim convert <trace.dat> <trace.bin>
+int convert_trace(const string &in_name, const string &out_name){
+    MappedFile *in = new MappedFile;
+    if(!in->open(in_name)){
+        delete in;
+        return 1;
+    }
+    MappedTextTraceSource source(in);
+    FILE *out = fopen(out_name.c_str(), "wb");
+    if(out == nullptr){
+        cerr << "can't create binary trace: " << out_name << endl;
+        return 1;
+    }
+
+    Instruction inst;
+    vector<TraceRecord> records;
+    string text;
+    bool ok = fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, out) == TRACE_MAGIC_SIZE;
+    bool too_long = false;
+    while(ok && source.next(inst)){
+        // a block's text stays within TRACE_BLOCK_TEXT_BYTES after padding
+        if(inst.og_line.size() > TRACE_BLOCK_TEXT_BYTES - 8){
+            too_long = true;
+            break;
+        }
+        if(text.size() + inst.og_line.size() > TRACE_BLOCK_TEXT_BYTES - 8){
+            ok = write_trace_block(out, records, text) == 0;
+            if(!ok) break;
+        }
+        TraceRecord rec;
+        rec.memory_address = inst.memory_address;
+        rec.text_offset = text.size();
+        rec.text_length = inst.og_line.size();
+        rec.opcode = inst.opcode;
+        rec.dest_reg = inst.dest_reg;
+        rec.src_reg1 = inst.src_reg1;
+        rec.src_reg2 = inst.src_reg2;
+        records.push_back(rec);
+        text += inst.og_line;
+        if(records.size() == TRACE_BLOCK_RECORDS) ok = write_trace_block(out, records, text) == 0;
+    }
+    if(ok && !records.empty()) ok = write_trace_block(out, records, text) == 0;
+    if(fclose(out) != 0) ok = false;
+
+    if(!ok) cerr << "error writing binary trace: " << out_name << endl;
+    if(too_long) cerr << in_name << ": a line is too long for the binary format" << endl;
+    if(!ok || too_long || source.failed()){
+        remove(out_name.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// every key config.txt understands and the Config field it sets
+struct ConfigKey {
+    const char *section;
+    const char *key;
+    int Config::*field;
+    int max;                // largest value check_config() allows, the least is 1
+};
+
+const ConfigKey config_keys[] = {
+    {"buffers",   "eff addr",  &Config::eff_addr_stations,   MAX_STATIONS},
+    {"buffers",   "fp adds",   &Config::fp_add_stations,     MAX_STATIONS},
+    {"buffers",   "fp muls",   &Config::fp_mul_stations,     MAX_STATIONS},
+    {"buffers",   "ints",      &Config::int_stations,        MAX_STATIONS},
+    {"buffers",   "reorder",   &Config::reorder_buffer_size, MAX_ROB_ENTRIES},
+    {"latencies", "fp_add",    &Config::fp_add_latency,      MAX_LATENCY},
+    {"latencies", "fp_sub",    &Config::fp_sub_latency,      MAX_LATENCY},
+    {"latencies", "fp_mul",    &Config::fp_mul_latency,      MAX_LATENCY},
+    {"latencies", "fp_div",    &Config::fp_div_latency,      MAX_LATENCY},
+    {"widths",    "issue",     &Config::issue_width,         MAX_WIDTH},
+    {"widths",    "cdbs",      &Config::cdb_count,           MAX_WIDTH},
+    {"widths",    "commit",    &Config::commit_width,        MAX_WIDTH},
+    {"widths",    "mem ports", &Config::mem_ports,           MAX_WIDTH},
+};
+
+// keys are unique across sections, so the key alone is enough to find one
+const ConfigKey *find_config_key(const string &key){
+    for(const ConfigKey &k : config_keys){
+        if(key == k.key) return &k;
+    }
+    return nullptr;
+}
+
+// "  key :  value " -> "key", "value"
+void split_config_line(const string &line, string &key, string &value){
+    size_t colon = line.find(':');
+    key = line.substr(0, colon);
+    value = colon == string::npos ? "" : line.substr(colon + 1);
+    key.erase(0, key.find_first_not_of(" \t"));
+    key.erase(key.find_last_not_of(" \t") + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+}
+
+// nullptr if the simulator can run with config, otherwise what is wrong
+const char *check_config(const Config &config){
+    for(const ConfigKey &k : config_keys){
+        if(config.*k.field < 1) return "every buffer size, latency and width must be at least 1";
+    }
+    if(config.reorder_buffer_size > MAX_ROB_ENTRIES) return "the reorder buffer can have at most 32767 entries";
+    for(const ConfigKey &k : config_keys){
+        if(config.*k.field <= k.max) continue;
+        if(strcmp(k.section, "latencies") == 0) return "latencies can be at most 100000 cycles";
+        if(strcmp(k.section, "widths") == 0) return "widths can be at most 32767";
+        return "a reservation station pool can have at most 32767 entries";
+    }
+    return nullptr;
 }
 
 int parse_config(string filename, Config &config){
@@ -128,6 +940,11 @@ int parse_config(string filename, Config &config){
         cerr << "can't open config: " << filename << endl;
         return -1;
     }
+    config = Config();
+    config.issue_width = 1;
+    config.cdb_count = 1;
+    config.commit_width = 1;
+    config.mem_ports = 1;
     string line; 
     string section;
 
@@ -135,44 +952,173 @@ int parse_config(string filename, Config &config){
         size_t start = line.find_first_not_of(" \t\r\n");
         if(start == string::npos ) continue; 
         
-        if(line == "buffers"){
-            section = "buffers";
-            continue;
-        }
-        else if(line == "latencies"){
-            section = "latencies"; 
+        if(line == "buffers" || line == "latencies" || line == "widths"){
+            section = line;
             continue;
         }
 
-        size_t colon = line.find(':');
-        string key = line.substr(0, colon);
-        string value = line.substr(colon + 1);
-        key.erase(0, key.find_first_not_of(" \t"));
-        key.erase(key.find_last_not_of(" \t") + 1);
-        value.erase(0, value.find_first_not_of(" \t"));
-        value.erase(value.find_last_not_of(" \t") + 1);
+        string key, value;
+        split_config_line(line, key, value);
         int int_value = stoi(value);
-        if(section == "buffers"){
-            if(key == "eff addr") config.eff_addr_stations = int_value; 
-            else if(key == "fp adds") config.fp_add_stations = int_value;
-            else if(key == "fp muls") config.fp_mul_stations = int_value;
-            else if(key == "ints") config.int_stations = int_value;
-            else if(key == "reorder") config.reorder_buffer_size = int_value;
-        }
-        else if(section == "latencies"){
-            if(key == "fp_add") config.fp_add_latency = int_value;
-            else if(key == "fp_sub") config.fp_sub_latency = int_value;
-            else if(key == "fp_mul") config.fp_mul_latency = int_value;
-            else if(key == "fp_div") config.fp_div_latency = int_value;
+        const ConfigKey *config_key = find_config_key(key);
+        if(config_key != nullptr && section == config_key->section){
+            config.*config_key->field = int_value;
         }
     }
     file.close();
+
+    // Every pool needs at least one entry or its instructions could never
+    // issue; beyond that only the ROB is capped, by the width of its tags.
+    const char *problem = check_config(config);
+    if(problem){
+        cerr << filename << ": " << problem << endl;
+        return -1;
+    }
     return 0;
 }
 
+// Buffered writer for the report. Rows are formatted straight into one
+// reusable buffer that goes out to the file whenever it fills, so output
+// starts right away and memory stays flat no matter how long the trace is.
+class ResultWriter {
+    public:
+    ResultWriter(FILE *fp) : fp(fp), buf(OUTPUT_BUFFER_SIZE), len(0) {}
+    ~ResultWriter(){ flush(); }
+
+    void put(char c){
+        if(len == buf.size()) flush();
+        buf[len++] = c;
+    }
+
+    void put(const char *s, size_t n){
+        if(len + n > buf.size()){
+            flush();
+            if(n > buf.size()){
+                fwrite(s, 1, n, fp);
+                return;
+            }
+        }
+        memcpy(&buf[len], s, n);
+        len += n;
+    }
+
+    void put(const char *s){ put(s, strlen(s)); }
+    void put(const string &s){ put(s.data(), s.size()); }
+
+    // pad with spaces up to width, same as %-<width>s
+    void put_left(const string &s, int width){
+        put(s);
+        for(int i = (int)s.size(); i < width; i++) put(' ');
+    }
+
+    // pad with spaces in front up to width, same as %<width>s
+    void put_right(const string &s, int width){
+        for(int i = (int)s.size(); i < width; i++) put(' ');
+        put(s);
+    }
+
+    // right justified in width, same as %<width>d
+    void put_int(long long value, int width = 0){
+        char digits[21];
+        int n = 0;
+        unsigned long long v = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while(v != 0);
+        if(value < 0) digits[n++] = '-';
+        for(int i = n; i < width; i++) put(' ');
+        while(n > 0) put(digits[--n]);
+    }
+
+    // a CSV field, quoted when it holds a comma or quote
+    void put_csv(const char *s, size_t n){
+        bool quote = false, escape = false;
+        for(size_t i = 0; i < n; i++){
+            if(s[i] == ',' || s[i] == '\n') quote = true;
+            else if(s[i] == '"') quote = escape = true;
+        }
+        if(!quote){
+            put(s, n);
+            return;
+        }
+        put('"');
+        if(!escape) put(s, n);
+        else for(size_t i = 0; i < n; i++){
+            if(s[i] == '"') put('"');
+            put(s[i]);
+        }
+        put('"');
+    }
+
+    // a quoted JSON string
+    void put_json(const char *s, size_t n){
+        put('"');
+        size_t i = 0;
+        while(i < n && s[i] != '"' && s[i] != '\\' && (unsigned char)s[i] >= 0x20) i++;
+        put(s, i);
+        for(; i < n; i++){
+            char c = s[i];
+            if(c == '"' || c == '\\'){
+                put('\\');
+                put(c);
+            }
+            else if((unsigned char)c < 0x20){
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                put(escape, 6);
+            }
+            else put(c);
+        }
+        put('"');
+    }
+    void put_json(const char *s){ put_json(s, strlen(s)); }
+
+    // three decimals, right justified in width
+    void put_fixed(double value, int width = 0){
+        char text[64];
+        int n = snprintf(text, sizeof(text), "%*.3f", width, value);
+        put(text, n);
+    }
+
+    void flush(){
+        if(len == 0) return;
+        fwrite(&buf[0], 1, len, fp);
+        len = 0;
+    }
+
+    // finish the current file and carry on in another, keeping the buffer
+    void set_file(FILE *new_fp){
+        flush();
+        fp = new_fp;
+    }
+
+    private:
+    FILE *fp;
+    vector<char> buf;
+    size_t len;
+};
+
+// what the report looks like: the dynamsched layout, or one line per
+// instruction for other programs to read
+enum ReportFormat { TEXT_REPORT, CSV_REPORT, NDJSON_REPORT };
+const char *report_format_names[] = {"text", "csv", "ndjson"};
+const char *report_suffixes[] = {".out", ".csv", ".ndjson"};
+
+// Stages an instruction goes through in the Kanata log, with the waits
+// between them named by what held it up.
+enum LogStage {
+    NO_STAGE,
+    ROB_STALL, RS_STALL,        // can't issue: ROB full, station pool full
+    ISSUE_STAGE, OPERAND_WAIT, EXECUTE_STAGE,
+    MEM_PORT_WAIT, MEM_DEP_WAIT, MEM_READ_STAGE,
+    CDB_WAIT, WRITE_BACK_STAGE,
+    COMMIT_WAIT, STORE_DATA_WAIT // behind older instructions, store at the head without its data
+};
+const char *log_stage_names[] = {"", "Rb", "Rs", "Is", "Dp", "Ex", "Mp", "Md", "Mr", "Cb", "Wb", "Cw", "Sd"};
+
 class Simulator {
     public:
-    vector<Instruction> instructions;
     int completed_instructions = 0;
         
     int fp_add_latency;
@@ -180,172 +1126,847 @@ class Simulator {
     int fp_mul_latency;
     int fp_div_latency;
 
-    char out[MAXLINES][LINESIZE];
-    int lines;
-    bool first_output;
+    int issue_width;
+    int cdb_count;
+    int commit_width;
+    int mem_ports;
 
-    Simulator(const Config &config, const vector<Instruction> &instrs) {
-        eff_addr_stations.resize(config.eff_addr_stations);
-        fp_add_stations.resize(config.fp_add_stations);
-        fp_mul_stations.resize(config.fp_mul_stations);
-        int_stations.resize(config.int_stations);
+    bool first_output;
+    // jump over cycles where nothing can change instead of stepping through them
+    bool skip_idle_cycles;
+    // count occupancy every cycle and latency per commit, for print_stats()
+    // and write_stats_json() once the run is over
+    bool collect_stats;
+    ReportFormat format;
+    // if set, stage events are streamed here as a Kanata log for Konata
+    ResultWriter *kanata;
+
+    // out may be null to run without writing the report (sweeps only want the totals)
+    Simulator(const Config &config, TraceSource &trace, ResultWriter *out){
+        int station_counts[NUM_STATION_CLASSES] = {
+            config.eff_addr_stations, config.fp_add_stations, config.fp_mul_stations, config.int_stations
+        };
+        int total_stations = 0;
+        for(int c = 0; c < NUM_STATION_CLASSES; c++) total_stations += station_counts[c];
+        station_slots.resize(total_stations);
+        reservation_station_slot *next_slot = station_slots.data();
+        for(int c = 0; c < NUM_STATION_CLASSES; c++){
+            station_pool &pool = pools[c];
+            pool.first = next_slot;
+            pool.size = station_counts[c];
+            pool.free_slots.reserve(pool.size);
+            for(int i = 0; i < pool.size; i++) next_slot[i].station = c;
+            next_slot += pool.size;
+        }
         reorder_buffer.resize(config.reorder_buffer_size);
-
-        instructions = instrs;
+        waiting_slots.resize(config.reorder_buffer_size);
+        waiting_stores.resize(config.reorder_buffer_size);
+        instrs.resize(config.reorder_buffer_size);
 
         fp_add_latency = config.fp_add_latency;
         fp_sub_latency = config.fp_sub_latency;
         fp_mul_latency = config.fp_mul_latency;
         fp_div_latency = config.fp_div_latency;
+        issue_width = config.issue_width;
+        cdb_count = config.cdb_count;
+        commit_width = config.commit_width;
+        mem_ports = config.mem_ports;
+
+        for(int t = 0; t < NUM_INSTR_TYPES; t++){
+            const TypeInfo &info = instr_types[t];
+            latency[t] = info.latency ? config.*info.latency : 1;
+            pool_for_type[t] = info.station == NO_RS ? nullptr : &pools[info.station];
+        }
+
+        ready_slots.reserve(total_stations);
+        loads_awaiting_mem.resize(config.reorder_buffer_size);
+        cdb_ready.resize(config.reorder_buffer_size);
+        inflight_stores.reserve(config.reorder_buffer_size);
+        skip_idle_cycles = true;
+        collect_stats = false;
+        format = TEXT_REPORT;
+        kanata = nullptr;
+        this->config = config;
+
+        reset(trace, out);
+    }
+
+    // Get ready to run another trace with the same config. Everything sized
+    // by the config is kept, so batch runs don't reallocate per trace.
+    void reset(TraceSource &new_trace, ResultWriter *new_out){
+        trace = &new_trace;
+        out = new_out;
+
+        for(int c = 0; c < NUM_STATION_CLASSES; c++){
+            station_pool &pool = pools[c];
+            pool.free_slots.clear();
+            for(int i = pool.size - 1; i >= 0; i--){
+                pool.first[i].busy = false;
+                pool.free_slots.push_back(&pool.first[i]);
+            }
+        }
+        reorder_buffer.assign(reorder_buffer.size(), reorder_buffer_entry());
+        for(auto &waiting : waiting_slots) waiting.clear();
+        for(auto &waiting : waiting_stores) waiting.clear();
+        ready_slots.clear();
+        while(!executing_slots.empty()) executing_slots.pop();
+        loads_awaiting_mem.resize(loads_awaiting_mem.size);
+        cdb_ready.resize(cdb_ready.size);
+        cdb_arrivals.clear();
+        inflight_stores.clear();
+
         cycle = 0;
+        completed_instructions = 0;
 
         rb_delays = 0;
         rs_delays = 0;
         dmc_delays = 0;
         true_dep_delays = 0;
 
+        blocked_slots = 0;
+        blocked_issued_this_cycle = 0;
+
         next_instr_issue = 0;
+        has_pending = false;
+        trace_done = false;
         rob_start = 0;
         rob_end = 0;
-        mem_used = false;
+        mem_accesses = 0;
         first_output = true;
-        committed_this_cycle = false;
-    }
-
-    void print_output(){
-        printf("Configuration\n");
-        printf("-------------\n");
-        printf("buffers:\n");
-        printf("   eff addr: %d\n", (int)eff_addr_stations.size());
-        printf("    fp adds: %d\n", (int)fp_add_stations.size());
-        printf("    fp muls: %d\n", (int)fp_mul_stations.size());
-        printf("       ints: %d\n", (int)int_stations.size());
-        printf("    reorder: %d\n", (int)reorder_buffer.size());
-        printf("\n");
-        printf("latencies:\n");
-        printf("   fp add: %d\n", fp_add_latency);
-        printf("   fp sub: %d\n", fp_sub_latency);
-        printf("   fp mul: %d\n", fp_mul_latency);
-        printf("   fp div: %d\n", fp_div_latency);
-        printf("\n\n");
-        for(int i = 0; i < lines; i++){
-            printf("%s", out[i]);
-        }
-        printf("\n\n");
-        printf("Delays\n");
-        printf("------\n");
-        printf("reorder buffer delays: %d\n", rb_delays);
-        printf("reservation station delays: %d\n", rs_delays);
-        printf("data memory conflict delays: %d\n", dmc_delays);
-        printf("true dependence delays: %d\n", true_dep_delays);
+        commits_this_cycle = 0;
+        cdb_writes = 0;
+        for(int r = 0; r < NUM_REGS; r++) reorder_status[r] = -1;
+    }
+
+    void print_config(){
+        if(!out) return;
+        if(format == CSV_REPORT){
+            // only the table, so any CSV reader takes it as is; the config
+            // and delays are in --stats-json
+            out->put("index,instruction,opcode,issue,execute_start,execute_end,mem_read,write_result,commit\n");
+            return;
+        }
+        if(format == NDJSON_REPORT){
+            out->put("{\"config\": {");
+            for(const ConfigKey &k : config_keys){
+                if(&k != config_keys) out->put(", ");
+                out->put_json(k.key); out->put(": "); out->put_int(config.*k.field);
+            }
+            out->put("}}\n");
+            return;
+        }
+        out->put("Configuration\n");
+        out->put("-------------\n");
+        out->put("buffers:\n");
+        out->put("   eff addr: "); out->put_int(pools[EFF_ADDR_RS].size); out->put('\n');
+        out->put("    fp adds: "); out->put_int(pools[FP_ADD_RS].size); out->put('\n');
+        out->put("    fp muls: "); out->put_int(pools[FP_MUL_RS].size); out->put('\n');
+        out->put("       ints: "); out->put_int(pools[INT_RS].size); out->put('\n');
+        out->put("    reorder: "); out->put_int(reorder_buffer.size()); out->put('\n');
+        out->put("\n");
+        out->put("latencies:\n");
+        out->put("   fp add: "); out->put_int(fp_add_latency); out->put('\n');
+        out->put("   fp sub: "); out->put_int(fp_sub_latency); out->put('\n');
+        out->put("   fp mul: "); out->put_int(fp_mul_latency); out->put('\n');
+        out->put("   fp div: "); out->put_int(fp_div_latency); out->put('\n');
+        // only shown for wide machines so the single-issue report matches dynamsched
+        if(issue_width != 1 || cdb_count != 1 || commit_width != 1 || mem_ports != 1){
+            out->put("\n");
+            out->put("widths:\n");
+            out->put("      issue: "); out->put_int(issue_width); out->put('\n');
+            out->put("       cdbs: "); out->put_int(cdb_count); out->put('\n');
+            out->put("     commit: "); out->put_int(commit_width); out->put('\n');
+            out->put("  mem ports: "); out->put_int(mem_ports); out->put('\n');
+        }
+        out->put("\n\n");
+    }
+
+    void print_delays(){
+        if(!out) return;
+        if(format == CSV_REPORT){
+            out->flush();
+            return;
+        }
+        if(format == NDJSON_REPORT){
+            out->put("{\"cycles\": "); out->put_int(cycle);
+            out->put(", \"delays\": {\"reorder_buffer\": "); out->put_int(rb_delays);
+            out->put(", \"reservation_station\": "); out->put_int(rs_delays);
+            out->put(", \"data_memory_conflict\": "); out->put_int(dmc_delays);
+            out->put(", \"true_dependence\": "); out->put_int(true_dep_delays);
+            out->put("}}\n");
+            out->flush();
+            return;
+        }
+        out->put("\n\n");
+        out->put("Delays\n");
+        out->put("------\n");
+        out->put("reorder buffer delays: "); out->put_int(rb_delays); out->put('\n');
+        out->put("reservation station delays: "); out->put_int(rs_delays); out->put('\n');
+        out->put("data memory conflict delays: "); out->put_int(dmc_delays); out->put('\n');
+        out->put("true dependence delays: "); out->put_int(true_dep_delays); out->put('\n');
+        out->flush();
+    }
+
+    // one row of the pipeline table, written as the instruction commits
+    void print_row(int rob_index){
+        if(!out) return;
+        if(format != TEXT_REPORT){
+            print_record(rob_index);
+            return;
+        }
+        if(first_output){
+            out->put("                    Pipeline Simulation\n");
+            out->put("-----------------------------------------------------------\n");
+            out->put("                                      Memory Writes\n");
+            out->put("     Instruction      Issues Executes  Read  Result Commits\n");
+            out->put("--------------------- ------ -------- ------ ------ -------\n");
+            first_output = false;
+        }
+        out->put_left(instrs.og_line[rob_index], 21);
+        out->put(' ');
+        out->put_int(instrs.issue_cycle[rob_index], 6);
+        out->put(' ');
+        out->put_int(instrs.execute_start_cycle[rob_index], 3);
+        out->put(" -");
+        out->put_int(instrs.execute_complete_cycle[rob_index], 3);
+        out->put(' ');
+
+        if(instrs.mem_read_cycle[rob_index] == -1){
+            out->put("       ");
+        } else {
+            out->put_int(instrs.mem_read_cycle[rob_index], 6);
+            out->put(' ');
+        }
+
+        if(!instr_types[instrs.type[rob_index]].writes_result){
+            out->put("       ");
+        } else {
+            out->put_int(instrs.write_back_cycle[rob_index], 6);
+            out->put(' ');
+        }
+
+        out->put_int(instrs.commit_cycle[rob_index], 7);
+        out->put('\n');
+    }
+
+    // The row as a CSV line or JSON object. index counts from 0 in trace
+    // order, the opcode is the one the decoder found, and stages the
+    // instruction doesn't go through are empty (CSV) or null (JSON).
+    void print_record(int rob_index){
+        const string &line = instrs.og_line[rob_index];
+        const char *opcode = opcodes[instrs.opcode[rob_index]].name;
+        bool writes_result = instr_types[instrs.type[rob_index]].writes_result;
+        int stages[6] = {
+            instrs.issue_cycle[rob_index], instrs.execute_start_cycle[rob_index],
+            instrs.execute_complete_cycle[rob_index], instrs.mem_read_cycle[rob_index],
+            writes_result ? instrs.write_back_cycle[rob_index] : -1, instrs.commit_cycle[rob_index]
+        };
+        static const char *stage_names[6] = {"issue", "execute_start", "execute_end", "mem_read", "write_result", "commit"};
+
+        if(format == CSV_REPORT){
+            out->put_int(completed_instructions);
+            out->put(',');
+            out->put_csv(line.data(), line.size());
+            out->put(',');
+            out->put(opcode);
+            for(int i = 0; i < 6; i++){
+                out->put(',');
+                if(stages[i] != -1) out->put_int(stages[i]);
+            }
+            out->put('\n');
+            return;
+        }
+
+        out->put("{\"index\": "); out->put_int(completed_instructions);
+        out->put(", \"instruction\": "); out->put_json(line.data(), line.size());
+        out->put(", \"opcode\": "); out->put_json(opcode);
+        for(int i = 0; i < 6; i++){
+            out->put(", \"");
+            out->put(stage_names[i]);
+            out->put("\": ");
+            if(stages[i] != -1) out->put_int(stages[i]);
+            else out->put("null");
+        }
+        out->put("}\n");
     }
 
+    int cycles() const { return cycle; }
+    long long reorder_buffer_delays() const { return rb_delays; }
+    long long reservation_station_delays() const { return rs_delays; }
+    long long data_memory_conflict_delays() const { return dmc_delays; }
+    long long true_dependence_delays() const { return true_dep_delays; }
+
     void run(){
+        print_config();
+
+        if(collect_stats) clear_stats();
+        if(kanata) start_log();
 
-        while(completed_instructions < instructions.size()){
+        while(fetch_next() || completed_instructions < next_instr_issue){
             cycle++;
-            mem_used = false;
-            committed_this_cycle = false;
+            mem_accesses = 0;
+            commits_this_cycle = 0;
+            cdb_writes = 0;
+            progress = false;
+            blocked_issued_this_cycle = 0;
+            long long rb_before = rb_delays;
+            long long rs_before = rs_delays;
+            long long dmc_before = dmc_delays;
+            long long true_dep_before = true_dep_delays;
 
             issue();
             execute();
             mem_read();
             write_back();
             commit();
+            if(kanata) log_waits();
+
+            int skipped = 0;
+            if(skip_idle_cycles && !progress){
+                skipped = skip_ahead(rb_delays - rb_before, rs_delays - rs_before,
+                                     dmc_delays - dmc_before, true_dep_delays - true_dep_before);
+            }
+            // skipped cycles are copies of this one, so they count the same
+            if(collect_stats) sample_cycle(1 + skipped);
+        }
+
+        print_delays();
+        if(kanata) kanata->flush();
+
+    }
+
+    void print_stats(){
+        if(!out) return;
+        out->put("\n\n");
+        out->put("Statistics\n");
+        out->put("----------\n");
+        out->put("cycles: "); out->put_int(cycle); out->put('\n');
+        out->put("instructions: "); out->put_int(completed_instructions); out->put('\n');
+        out->put("IPC: "); out->put_fixed(cycle ? (double)completed_instructions / cycle : 0.0); out->put('\n');
+
+        print_histogram("reorder buffer entries", stats.rob_occupancy);
+        for(int c = 0; c < NUM_STATION_CLASSES; c++){
+            print_histogram((string)station_names[c] + " stations", stats.station_occupancy[c]);
+        }
+        print_histogram("CDB writes", stats.cdb_use);
+        print_histogram("memory accesses", stats.mem_port_use);
+
+        out->put("\nissue to commit latency:\n");
+        out->put(" opcode     count     mean   max\n");
+        for(int op = 0; op < NUM_OPCODES; op++){
+            long long count = 0;
+            for(int b = 0; b < LATENCY_BUCKETS; b++) count += stats.latency[op][b];
+            if(count == 0) continue;
+            out->put_right(opcodes[op].name, 7);
+            out->put_int(count, 10);
+            out->put_fixed((double)stats.latency_total[op] / count, 9);
+            out->put_int(stats.latency_max[op], 6);
+            out->put('\n');
+        }
+        for(int op = 0; op < NUM_OPCODES; op++){
+            if(stats.latency_max[op] < 0) continue;
+            out->put('\n');
+            out->put(opcodes[op].name);
+            out->put(" latency:\n");
+            out->put("  cycles     count\n");
+            int last = min(stats.latency_max[op], LATENCY_BUCKETS - 1);
+            for(int b = 0; b <= last; b++){
+                if(stats.latency[op][b] == 0) continue;
+                out->put_int(b, 6);
+                out->put(b == LATENCY_BUCKETS - 1 ? "+ " : "  ");
+                out->put_int(stats.latency[op][b], 8);
+                out->put('\n');
+            }
+        }
+        out->flush();
+    }
+
+    // the same numbers as print_stats(), as one JSON object
+    void write_stats_json(ResultWriter &json){
+        json.put("{\"cycles\": "); json.put_int(cycle);
+        json.put(", \"instructions\": "); json.put_int(completed_instructions);
+        json.put(", \"delays\": {\"reorder_buffer\": "); json.put_int(rb_delays);
+        json.put(", \"reservation_station\": "); json.put_int(rs_delays);
+        json.put(", \"data_memory_conflict\": "); json.put_int(dmc_delays);
+        json.put(", \"true_dependence\": "); json.put_int(true_dep_delays);
+        json.put("},\n \"config\": {");
+        for(const ConfigKey &k : config_keys){
+            if(&k != config_keys) json.put(", ");
+            json.put_json(k.key); json.put(": "); json.put_int(config.*k.field);
+        }
+        json.put("},\n \"reorder_buffer\": "); put_json_histogram(json, stats.rob_occupancy);
+        json.put(",\n \"stations\": {");
+        for(int c = 0; c < NUM_STATION_CLASSES; c++){
+            json.put(c ? ",\n  \"" : "\n  \"");
+            json.put(station_names[c]);
+            json.put("\": ");
+            put_json_histogram(json, stats.station_occupancy[c]);
+        }
+        json.put("},\n \"cdb\": "); put_json_histogram(json, stats.cdb_use);
+        json.put(",\n \"memory_ports\": "); put_json_histogram(json, stats.mem_port_use);
+        json.put(",\n \"latency\": {");
+        bool first = true;
+        for(int op = 0; op < NUM_OPCODES; op++){
+            if(stats.latency_max[op] < 0) continue;
+            long long count = 0;
+            for(int b = 0; b < LATENCY_BUCKETS; b++) count += stats.latency[op][b];
+            json.put(first ? "\n  \"" : ",\n  \"");
+            first = false;
+            json.put(opcodes[op].name);
+            json.put("\": {\"count\": "); json.put_int(count);
+            json.put(", \"mean\": "); json.put_fixed((double)stats.latency_total[op] / count);
+            json.put(", \"max\": "); json.put_int(stats.latency_max[op]);
+            json.put(", \"histogram\": [");
+            int last = min(stats.latency_max[op], LATENCY_BUCKETS - 1);
+            for(int b = 0; b <= last; b++){
+                if(b) json.put(", ");
+                json.put_int(stats.latency[op][b]);
+            }
+            json.put("]}");
+        }
+        json.put("}}\n");
+        json.flush();
+    }
+
+
+    private:
+    Config config;
+    int cycle;
+    // per cycle, against commit_width and mem_ports
+    int commits_this_cycle;
+    int mem_accesses;
+    int cdb_writes;
+    bool progress; // set by any stage that changes pipeline state this cycle
+    long long rb_delays;
+    long long rs_delays;
+    long long dmc_delays;
+    long long true_dep_delays;
+    int reorder_status[NUM_REGS]; // register -> ROB entry producing it (-1 if ready)
+
+    TraceSource *trace;
+    ResultWriter *out;
+    Instruction pending; // next instruction to issue, valid when has_pending
+    bool has_pending;
+    bool trace_done;
+
+    int next_instr_issue;
+    int rob_start;
+    int rob_end;
+
+
+    // In-flight instruction state, indexed by the ROB entry holding it. The
+    // fields the stages test every cycle sit in their own arrays, apart from
+    // the display text only print_row() reads. Source registers are only
+    // needed at issue, so they are read from the pending record and not kept.
+    struct instruction_table{
+        vector<InstrType> type;
+        vector<Opcode> opcode;
+        vector<int> memory_address;
+        vector<int> issue_cycle;
+        vector<int> execute_start_cycle;
+        vector<int> execute_complete_cycle;
+        vector<int> mem_read_cycle;
+        vector<int> write_back_cycle;
+        vector<int> commit_cycle;
+        vector<string> og_line;
+
+        void resize(int n){
+            type.resize(n);
+            opcode.resize(n);
+            memory_address.resize(n);
+            issue_cycle.resize(n);
+            execute_start_cycle.resize(n);
+            execute_complete_cycle.resize(n);
+            mem_read_cycle.resize(n);
+            write_back_cycle.resize(n);
+            commit_cycle.resize(n);
+            og_line.resize(n);
+        }
+    };
+    instruction_table instrs;
+
+    // Stations and ROB entries are small packed PODs: ROB tags are 16 bits
+    // and the flags are bitfields, so a station is 8 bytes and a ROB entry
+    // 12, and the stages' walks over them stay within a few cache lines.
+    struct reservation_station_slot{
+        // ROB tags of the operands still awaited, -1 once ready
+        int16_t operand1;
+        int16_t operand2;
+        int16_t dest_rob_entry;
+        uint8_t station;        // StationClass of the pool the slot goes back to
+        bool busy : 1;
+        bool executing : 1;
+        bool is_store : 1;      // stores only need operand2 (the address) to execute
+    };
+    struct reorder_buffer_entry{
+        int station;            // index in station_slots, held until execute (loads: until the memory read)
+        int16_t store_data_dependency;
+        int16_t next_store;     // next younger uncommitted store to the same address (-1 if none)
+        int8_t destination_register;
+        bool busy : 1;
+        bool ready : 1;
+    };
+
+    // consumers waiting on each ROB entry's result, woken by broadcast(); kept
+    // apart from the entries since only issue and broadcast touch them
+    vector<vector<reservation_station_slot*> > waiting_slots;
+    vector<vector<int16_t> > waiting_stores; // ROB entries of stores whose data comes from here
+
+    // uncommitted stores per address, oldest first, chained through next_store
+    struct store_chain{
+        int oldest;
+        int newest;
+    };
+    unordered_map<int, store_chain> inflight_stores;
+
+    // every station, one pool after another in a single block
+    vector<reservation_station_slot> station_slots;
+    struct station_pool{
+        reservation_station_slot *first; // the pool's slots in station_slots
+        int size;
+        vector<reservation_station_slot*> free_slots;
+    };
+    station_pool pools[NUM_STATION_CLASSES];
+    vector<reorder_buffer_entry> reorder_buffer;
+
+    // The stages never scan whole pools or the whole ROB; each one works from
+    // the queue of things that are actually waiting on it.
+
+    // slots with the operands they need to execute, not started yet
+    vector<reservation_station_slot*> ready_slots;
+    // slots still waiting on an operand (each costs a true dependence delay
+    // per cycle), and how many of those issued this cycle and don't count yet
+    int blocked_slots;
+    int blocked_issued_this_cycle;
+
+    // multi-cycle operations in flight, soonest finish first
+    struct in_flight{
+        int finish_cycle;
+        reservation_station_slot *slot;
+        bool operator>(const in_flight &other) const { return finish_cycle > other.finish_cycle; }
+    };
+    priority_queue<in_flight, vector<in_flight>, greater<in_flight> > executing_slots;
+
+    // One bit per ROB entry. ROB entries are allocated in trace order, so the
+    // oldest set entry is the first one found going round from the head: a
+    // rotate to the head plus count-trailing-zeros, 64 entries per step.
+    struct rob_bitmask{
+        vector<uint64_t> words;
+        int size;
+
+        void resize(int n){
+            size = n;
+            words.assign((n + 63) / 64, 0);
+        }
+        void set(int i){ words[i >> 6] |= (uint64_t)1 << (i & 63); }
+        void clear(int i){ words[i >> 6] &= ~((uint64_t)1 << (i & 63)); }
+
+        // first set entry at least age places after head, -1 if none
+        int find(int head, int age) const {
+            int start = head + age;
+            if(start >= size) return scan(start - size, head);
+            int found = scan(start, size);
+            return found != -1 ? found : scan(0, head);
+        }
+
+        // first set entry in [lo, hi)
+        int scan(int lo, int hi) const {
+            if(lo >= hi) return -1;
+            int w = lo >> 6;
+            uint64_t bits = words[w] & (~(uint64_t)0 << (lo & 63));
+            int last = (hi - 1) >> 6;
+            while(!bits){
+                if(++w > last) return -1;
+                bits = words[w];
+            }
+            int i = (w << 6) + __builtin_ctzll(bits);
+            return i < hi ? i : -1;
+        }
+    };
+
+    // executed loads waiting for the memory port
+    rob_bitmask loads_awaiting_mem;
+
+    // results waiting for the CDB. Results produced this cycle sit in
+    // cdb_arrivals until the next one.
+    rob_bitmask cdb_ready;
+    vector<int> cdb_arrivals;
+
+
+    // What collect_stats counts. Each histogram has a counter per possible
+    // value, sized from the config when the run starts: cycles spent with n
+    // entries busy, n CDBs written or n memory accesses made, and commits
+    // that took n cycles from issue (the last bucket takes everything longer).
+    struct run_stats{
+        vector<long long> rob_occupancy;
+        vector<long long> station_occupancy[NUM_STATION_CLASSES];
+        vector<long long> cdb_use;
+        vector<long long> mem_port_use;
+        long long latency[NUM_OPCODES][LATENCY_BUCKETS];
+        long long latency_total[NUM_OPCODES];
+        int latency_max[NUM_OPCODES];   // -1 until a commit of the opcode
+    };
+    run_stats stats;
+
+    void clear_stats(){
+        stats.rob_occupancy.assign(reorder_buffer.size() + 1, 0);
+        for(int c = 0; c < NUM_STATION_CLASSES; c++) stats.station_occupancy[c].assign(pools[c].size + 1, 0);
+        stats.cdb_use.assign(cdb_count + 1, 0);
+        stats.mem_port_use.assign(mem_ports + 1, 0);
+        memset(stats.latency, 0, sizeof(stats.latency));
+        memset(stats.latency_total, 0, sizeof(stats.latency_total));
+        for(int op = 0; op < NUM_OPCODES; op++) stats.latency_max[op] = -1;
+    }
+
+    // the state at the end of this cycle, standing for weight cycles
+    void sample_cycle(long long weight){
+        int rob_busy = rob_end - rob_start;
+        if(rob_busy < 0 || (rob_busy == 0 && reorder_buffer[rob_start].busy)) rob_busy += reorder_buffer.size();
+        stats.rob_occupancy[rob_busy] += weight;
+        for(int c = 0; c < NUM_STATION_CLASSES; c++){
+            stats.station_occupancy[c][pools[c].size - pools[c].free_slots.size()] += weight;
+        }
+        stats.cdb_use[cdb_writes] += weight;
+        stats.mem_port_use[mem_accesses] += weight;
+    }
+
+    void count_latency(int rob_index){
+        Opcode op = instrs.opcode[rob_index];
+        int cycles = instrs.commit_cycle[rob_index] - instrs.issue_cycle[rob_index];
+        stats.latency[op][min(cycles, LATENCY_BUCKETS - 1)]++;
+        stats.latency_total[op] += cycles;
+        stats.latency_max[op] = max(stats.latency_max[op], cycles);
+    }
+
+    // Kanata log state. Instructions are numbered by trace position in the
+    // log, and each ROB entry remembers the stage it was last shown in so a
+    // stage is only written when it changes.
+    vector<int> log_ids;
+    vector<uint8_t> log_stages;
+    LogStage pending_log_stage;     // NO_STAGE until the pending instruction is in the log
+    int log_cycle;                  // cycle of the last command written, -1 before the first
+    // Entries that moved on this cycle and last cycle. One that hasn't moved
+    // again a cycle later is waiting, see log_waits().
+    struct log_watch{
+        int rob_index;
+        int id;
+        LogStage stage;
+    };
+    vector<log_watch> log_watch_now;
+    vector<log_watch> log_watch_last;
+
+    void start_log(){
+        log_ids.assign(reorder_buffer.size(), -1);
+        log_stages.assign(reorder_buffer.size(), NO_STAGE);
+        pending_log_stage = NO_STAGE;
+        log_cycle = -1;
+        log_watch_now.clear();
+        log_watch_last.clear();
+        kanata->put("Kanata\t0004\n");
+    }
+
+    // commands apply at the current log cycle, so catch it up first
+    void log_advance(){
+        if(log_cycle == -1){
+            kanata->put("C=\t"); kanata->put_int(cycle); kanata->put('\n');
+        }
+        else if(cycle != log_cycle){
+            kanata->put("C\t"); kanata->put_int(cycle - log_cycle); kanata->put('\n');
+        }
+        log_cycle = cycle;
+    }
+
+    void log_new_instruction(int id, const string &line){
+        kanata->put("I\t"); kanata->put_int(id); kanata->put('\t'); kanata->put_int(id); kanata->put("\t0\n");
+        kanata->put("L\t"); kanata->put_int(id); kanata->put("\t0\t"); kanata->put(line); kanata->put('\n');
+    }
+
+    void log_start_stage(int id, LogStage stage){
+        kanata->put("S\t"); kanata->put_int(id); kanata->put("\t0\t"); kanata->put(log_stage_names[stage]); kanata->put('\n');
+    }
+
+    void log_stage(int rob_index, LogStage stage){
+        if(!kanata || log_stages[rob_index] == stage) return;
+        log_advance();
+        log_start_stage(log_ids[rob_index], stage);
+        log_stages[rob_index] = stage;
+    }
+
+    // a stage whose wait reason only shows a cycle later
+    void log_moved(int rob_index, LogStage stage){
+        if(!kanata) return;
+        log_stage(rob_index, stage);
+        log_watch w = {rob_index, log_ids[rob_index], stage};
+        log_watch_now.push_back(w);
+    }
+
+    // the pending instruction is held before issue; it enters the log then
+    void log_issue_stall(LogStage stage){
+        if(!kanata || pending_log_stage == stage) return;
+        log_advance();
+        if(pending_log_stage == NO_STAGE) log_new_instruction(next_instr_issue, pending.og_line);
+        log_start_stage(next_instr_issue, stage);
+        pending_log_stage = stage;
+    }
+
+    void log_issue(int rob_index){
+        if(!kanata) return;
+        log_advance();
+        log_ids[rob_index] = next_instr_issue;
+        if(pending_log_stage == NO_STAGE) log_new_instruction(next_instr_issue, instrs.og_line[rob_index]);
+        pending_log_stage = NO_STAGE;
+        log_stages[rob_index] = NO_STAGE;
+        log_moved(rob_index, ISSUE_STAGE);
+    }
+
+    // consumer waits on producer's result
+    void log_dependency(int consumer, int producer){
+        if(!kanata) return;
+        kanata->put("W\t"); kanata->put_int(log_ids[consumer]);
+        kanata->put('\t'); kanata->put_int(log_ids[producer]); kanata->put("\t0\n");
+    }
+
+    void log_retire(int rob_index){
+        if(!kanata) return;
+        log_advance();
+        kanata->put("R\t"); kanata->put_int(log_ids[rob_index]);
+        kanata->put('\t'); kanata->put_int(completed_instructions); kanata->put("\t0\n");
+    }
 
+    // End of cycle: whatever moved last cycle and is still in the same stage
+    // now couldn't go on. Waits the stages count as delays (memory port,
+    // memory dependence, store data) are logged where they're counted;
+    // these are the rest.
+    void log_waits(){
+        for(const log_watch &w : log_watch_last){
+            if(!reorder_buffer[w.rob_index].busy || log_ids[w.rob_index] != w.id) continue;
+            if(log_stages[w.rob_index] != w.stage) continue;
+            LogStage wait;
+            if(w.stage == ISSUE_STAGE) wait = OPERAND_WAIT;
+            else if(w.stage == MEM_READ_STAGE) wait = CDB_WAIT;
+            else if(w.stage == WRITE_BACK_STAGE) wait = COMMIT_WAIT;
+            else wait = instr_types[instrs.type[w.rob_index]].writes_result ? CDB_WAIT : COMMIT_WAIT;
+            log_stage(w.rob_index, wait);
         }
+        log_watch_last.swap(log_watch_now);
+        log_watch_now.clear();
+    }
 
-        print_output();
+    // cycle counts per value, then the mean and how much of the capacity was used
+    void print_histogram(const string &name, const vector<long long> &counts){
+        long long total = 0, sum = 0;
+        int capacity = counts.size() - 1;
+        for(int n = 0; n <= capacity; n++){
+            total += counts[n];
+            sum += counts[n] * n;
+        }
+        double mean = total ? (double)sum / total : 0.0;
+        out->put('\n');
+        out->put(name);
+        out->put(": mean ");
+        out->put_fixed(mean);
+        out->put(" of ");
+        out->put_int(capacity);
+        out->put(", ");
+        out->put_fixed(capacity ? 100.0 * mean / capacity : 0.0);
+        out->put("% used\n");
+        out->put("   busy    cycles\n");
+        for(int n = 0; n <= capacity; n++){
+            if(counts[n] == 0) continue;
+            out->put_int(n, 7);
+            out->put_int(counts[n], 10);
+            out->put('\n');
+        }
+    }
 
+    void put_json_histogram(ResultWriter &json, const vector<long long> &counts){
+        long long total = 0, sum = 0;
+        for(size_t n = 0; n < counts.size(); n++){
+            total += counts[n];
+            sum += counts[n] * n;
+        }
+        json.put("{\"capacity\": "); json.put_int(counts.size() - 1);
+        json.put(", \"mean\": "); json.put_fixed(total ? (double)sum / total : 0.0);
+        json.put(", \"cycles\": [");
+        for(size_t n = 0; n < counts.size(); n++){
+            if(n) json.put(", ");
+            json.put_int(counts[n]);
+        }
+        json.put("]}");
     }
 
+    // per-type latency and station pool, filled in from the config once
+    int latency[NUM_INSTR_TYPES];
+    station_pool *pool_for_type[NUM_INSTR_TYPES];
 
-    private:
-    int cycle;
-    // once per cycle
-    bool committed_this_cycle;
-    bool mem_used;
-    int rb_delays;
-    int rs_delays;
-    int dmc_delays;
-    int true_dep_delays;
-    map<string, int> reorder_status; // register -> ROB entry producing it (-1 if ready)
-    // key = when it was issued
-    // valid pair<int,int> = <ROB entry, RS type>
-    map<int, pair<int,int>> write_back_candidates;
+    int get_latency(InstrType type) {
+        return latency[type];
+    }
 
-    int next_instr_issue;
-    int rob_start;
-    int rob_end;
+    station_pool *get_reservation_station(InstrType type){
+        return pool_for_type[type];
+    }
 
+    // whether a slot is still missing an operand it needs to start executing
+    bool operands_pending(const reservation_station_slot &slot){
+        if(slot.is_store) return slot.operand2 != -1;
+        return slot.operand1 != -1 || slot.operand2 != -1;
+    }
 
-    struct reservation_station_slot{
-        bool busy;
-        int instruction_id; //index in instructions vector
-        
-        //dependency tracking 
-        //-1 if ready
-        int operand1;
-        int operand2;
-
-        int dest_rob_entry;
-        int remaining_cycles;
-        bool executing;
-    };
-    struct reorder_buffer_entry{
-        bool busy;
-        int instruction_id;      //index in instructions vector
-        string destination_register;
-        bool ready;    
-        int store_data_dependency;         
+    void free_station(reservation_station_slot &slot){
+        slot.busy = false;
+        pools[slot.station].free_slots.push_back(&slot);
+    }
 
-    };
-    vector<reservation_station_slot> eff_addr_stations;
-    vector<reservation_station_slot> fp_add_stations;
-    vector<reservation_station_slot> fp_mul_stations;
-    vector<reservation_station_slot> int_stations;
-    vector<reorder_buffer_entry> reorder_buffer;
+    // The cycle that just ran changed nothing but delay counters, so each
+    // following cycle plays out the same way until the first multi-cycle
+    // operation finishes. Jump to the cycle before that one and charge the
+    // skipped cycles this cycle's delays. Returns how many were skipped.
+    int skip_ahead(long long rb, long long rs, long long dmc, long long true_dep){
+        // nothing executing means nothing will ever change, leave that to the normal loop
+        if(executing_slots.empty()) return 0;
+
+        int skipped = executing_slots.top().finish_cycle - cycle - 1;
+        if(skipped <= 0) return 0;
+        cycle += skipped;
+        rb_delays += rb * skipped;
+        rs_delays += rs * skipped;
+        dmc_delays += dmc * skipped;
+        true_dep_delays += true_dep * skipped;
+        return skipped;
+    }
 
+    bool fetch_next(){
+        if(!has_pending && !trace_done){
+            has_pending = trace->next(pending);
+            trace_done = !has_pending;
+        }
+        return has_pending;
+    }
 
-    int get_latency(string type) {
-        if (type == "FP_ADD") return fp_add_latency;
-        if (type == "FP_SUB") return fp_sub_latency;
-        if (type == "FP_MUL") return fp_mul_latency;
-        if (type == "FP_DIV") return fp_div_latency;
-        if (type == "LOAD" || type == "STORE") return 1;  
-        if (type == "INT_ADD" || type == "INT_SUB") return 1;
-        if (type == "BRANCH") return 1;
-        return 1;
+    // on loads need to check for RAW since we don't actually access mem (hard codede addr)
+    // only the oldest uncommitted store to the address matters: the load depends on it iff it's older
+    bool check_mem_dependency(int load_rob_index){
+        unordered_map<int, store_chain>::iterator it = inflight_stores.find(instrs.memory_address[load_rob_index]);
+        if(it == inflight_stores.end()) return false;
+        return rob_age(it->second.oldest) < rob_age(load_rob_index);
     }
 
-    vector<reservation_station_slot> *get_reservation_station(string type){
-        if (type == "LOAD" || type == "STORE") return &eff_addr_stations;
-        if (type == "FP_ADD" || type == "FP_SUB") return &fp_add_stations;
-        if (type == "FP_MUL" || type == "FP_DIV") return &fp_mul_stations;
-        if (type == "INT_ADD" || type == "INT_SUB" || type == "BRANCH") return &int_stations;
-        return nullptr;
+    // position of a ROB entry counting from the head
+    int rob_age(int rob_index){
+        return (rob_index - rob_start + reorder_buffer.size()) % reorder_buffer.size();
     }
-    // on loads need to check for RAW since we don't actually access mem (hard codede addr)
-    bool check_mem_dependency(int load_id){
-        Instruction &load_inst = instructions[load_id];
-        for(int i = 0; i < load_id; i++){
-            Instruction &prev_inst = instructions[i];
-            if(prev_inst.type == "STORE" && prev_inst.memory_address == load_inst.memory_address){
-                if(prev_inst.execute_complete_cycle == -1){
-                    return true;
-                }
-                if(prev_inst.commit_cycle == -1){
-                    return true;
-                }
-            }
+
+    // issue in order until issue_width instructions went out or one stalls
+    void issue(){
+        for(int i = 0; i < issue_width; i++){
+            if(!issue_one()) return;
         }
-        return false;
     }
-    void issue(){
 
-        if(next_instr_issue >= instructions.size()) return; 
+    bool issue_one(){
 
-        Instruction &inst = instructions[next_instr_issue];
+        if(!fetch_next()) return false; 
 
 
         if(reorder_buffer[rob_end].busy && rob_start == rob_end){
@@ -353,7 +1974,8 @@ class Simulator {
             commit();
             if(reorder_buffer[rob_end].busy && rob_start == rob_end){
                 rb_delays++;  
-                return;
+                log_issue_stall(ROB_STALL);
+                return false;
 
             }
         }
@@ -362,76 +1984,107 @@ class Simulator {
         //Make sure ROB is not full
         if(reorder_buffer[rob_end].busy && rob_start == rob_end){
             rb_delays++;
-            return;
+            log_issue_stall(ROB_STALL);
+            return false;
         }
       
-        vector<reservation_station_slot> *rs = get_reservation_station(inst.type);
+        station_pool *rs = get_reservation_station(pending.type);
         if(rs == nullptr){
-            cerr << "Unknown instruction type should not be null!! " << inst.type << endl;
-            return;
+            cerr << "Unknown instruction type should not be null!! " << instr_types[pending.type].name << endl;
+            return false;
         }
 
         // find free slot in reservation station 
-        int free_rs_index = -1;
-        for(int i = 0; i < (*rs).size(); i++){
-            if(!(*rs)[i].busy){
-                free_rs_index = i;
-                break;
-            }
-        }
-        if(free_rs_index == -1){
+        if(rs->free_slots.empty()){
             rs_delays++;
-            return;
+            log_issue_stall(RS_STALL);
+            return false;
         }
 
+        // the pending record's fields now live with its ROB entry until commit
+        const Instruction &inst = pending;
+        has_pending = false;
+        instrs.type[rob_end] = inst.type;
+        instrs.opcode[rob_end] = inst.opcode;
+        instrs.memory_address[rob_end] = inst.memory_address;
+        instrs.issue_cycle[rob_end] = cycle;
+        instrs.execute_start_cycle[rob_end] = -1;
+        instrs.execute_complete_cycle[rob_end] = -1;
+        instrs.mem_read_cycle[rob_end] = -1;
+        instrs.write_back_cycle[rob_end] = -1;
+        instrs.commit_cycle[rob_end] = -1;
+        instrs.og_line[rob_end].swap(pending.og_line);
+        log_issue(rob_end);
+
         //set the ROB entry 
         reorder_buffer_entry &rob_entry = reorder_buffer[rob_end];
         rob_entry.busy = true;
-        rob_entry.instruction_id = next_instr_issue;
         rob_entry.destination_register = inst.dest_reg;
         rob_entry.ready = false;
         rob_entry.store_data_dependency = -1;
+        rob_entry.next_store = -1;
 
         // set reservation station slot
-        reservation_station_slot &rs_slot = (*rs)[free_rs_index];
+        reservation_station_slot &rs_slot = *rs->free_slots.back();
+        rs->free_slots.pop_back();
         rs_slot.busy = true;
-        rs_slot.instruction_id = next_instr_issue;
         rs_slot.dest_rob_entry = rob_end;
         rs_slot.executing = false;
-        rs_slot.remaining_cycles = get_latency(inst.type);
+        bool is_store = instr_types[inst.type].is_store;
+        rs_slot.is_store = is_store;
+        rob_entry.station = &rs_slot - station_slots.data();
+
+        if(is_store){
+            unordered_map<int, store_chain>::iterator it = inflight_stores.find(inst.memory_address);
+            if(it == inflight_stores.end()){
+                store_chain chain = {rob_end, rob_end};
+                inflight_stores[inst.memory_address] = chain;
+            }
+            else {
+                reorder_buffer[it->second.newest].next_store = rob_end;
+                it->second.newest = rob_end;
+            }
+        }
 
 
         // set status of source operands
 
-        if(!inst.src_reg1.empty()){
-            if(reorder_status.count(inst.src_reg1) > 0 && reorder_status[inst.src_reg1] != -1){
+        if(inst.src_reg1 != NO_REG){
+            if(reorder_status[inst.src_reg1] != -1){
                 int res_ind = reorder_status[inst.src_reg1];
                 // The dependency may already be cleared if it went through WB and not commited yet (reoder_status only track commit status)
                 if(!reorder_buffer[res_ind].busy || reorder_buffer[res_ind].ready){
                     rs_slot.operand1 = -1;
-                    if(inst.type == "STORE") rob_entry.store_data_dependency = -1;
+                    if(is_store) rob_entry.store_data_dependency = -1;
                 }
                 else{
                     rs_slot.operand1 = res_ind;
-                    if(inst.type == "STORE") rob_entry.store_data_dependency = res_ind;
+                    waiting_slots[res_ind].push_back(&rs_slot);
+                    log_dependency(rob_end, res_ind);
+                    if(is_store){
+                        rob_entry.store_data_dependency = res_ind;
+                        waiting_stores[res_ind].push_back(rob_end);
+                    }
                 }
             }
             else {
                 rs_slot.operand1 = -1; 
-                if (inst.type == "STORE") rob_entry.store_data_dependency = -1;
+                if (is_store) rob_entry.store_data_dependency = -1;
             }
 
         }
         else rs_slot.operand1 = -1;
 
-        if(!inst.src_reg2.empty()){
-            if(reorder_status.count(inst.src_reg2) > 0 && reorder_status[inst.src_reg2] != -1){
+        if(inst.src_reg2 != NO_REG){
+            if(reorder_status[inst.src_reg2] != -1){
                 int res_ind = reorder_status[inst.src_reg2];
                 if(!reorder_buffer[res_ind].busy || reorder_buffer[res_ind].ready){
                     rs_slot.operand2 = -1;
                 }
                 else{
                     rs_slot.operand2 = res_ind;
+                    waiting_slots[res_ind].push_back(&rs_slot);
+                    if(inst.src_reg2 != inst.src_reg1) log_dependency(rob_end, res_ind);
                 }
             }
             else {
@@ -440,327 +2093,893 @@ class Simulator {
         }
         else rs_slot.operand2 = -1;
 
-        if(!inst.dest_reg.empty()){
+        if(operands_pending(rs_slot)){
+            blocked_slots++;
+            blocked_issued_this_cycle++;
+        }
+        else ready_slots.push_back(&rs_slot);
+
+        if(inst.dest_reg != NO_REG){
             reorder_status[inst.dest_reg] = rob_end;
         }
         rob_end = (rob_end + 1) % reorder_buffer.size();
         next_instr_issue++;
-        inst.issue_cycle = cycle;
-
+        progress = true;
+        return true;
     }
 
-    void exec_helper(vector<reservation_station_slot> &rs_pool){
+    void execute(){
+        // finish multi-cycle operations that are done this cycle
+        while(!executing_slots.empty() && executing_slots.top().finish_cycle == cycle){
+            reservation_station_slot &rs = *executing_slots.top().slot;
+            executing_slots.pop();
+            rs.executing = false;
+            finish_execution(rs);
+        }
 
-        // continue executing items already executing given RS
-        for(auto &rs : rs_pool){
-            if(!rs.busy) continue;
-            Instruction &inst = instructions[rs.instruction_id];
-            if(rs.executing){
-                rs.remaining_cycles--;
-                if(rs.remaining_cycles == 0){
-                    inst.execute_complete_cycle = cycle;
-                    rs.executing = false;
-                    if(inst.type == "STORE" || inst.type == "BRANCH"){
-                        reorder_buffer[rs.dest_rob_entry].ready = true;
-                    }
-                    if(inst.type != "LOAD")rs.busy = false;
-                }
+        // start everything with its operands ready, except what issued this cycle
+        size_t kept = 0;
+        for(size_t i = 0; i < ready_slots.size(); i++){
+            reservation_station_slot &rs = *ready_slots[i];
+            int rob_index = rs.dest_rob_entry;
+            if(instrs.issue_cycle[rob_index] == cycle){
+                ready_slots[kept++] = &rs;
                 continue;
             }
-            if(inst.issue_cycle == cycle || inst.execute_complete_cycle != -1) continue;
-        
-            
-            // True dependnency check
-            if(inst.type == "STORE"){
-                if(rs.operand2 != -1){
-                    true_dep_delays++;
-                    continue;
-                }
-            }
-            // Another true dependency check
-            else if(rs.operand1 != -1 || rs.operand2 != -1){
-                true_dep_delays++;
-                continue;
-            }
-            
 
-            inst.execute_start_cycle = cycle;
-            int latency = get_latency(inst.type);
+            instrs.execute_start_cycle[rob_index] = cycle;
+            progress = true;
+            log_stage(rob_index, EXECUTE_STAGE);
+            int latency = get_latency(instrs.type[rob_index]);
             // do work for newly starting execution
             if(latency == 1){
                 // Complete immediately
-                inst.execute_complete_cycle = cycle;
-                rs.executing = false;  // Not executing (done!)
-                rs.remaining_cycles = 0;
-                if(inst.type == "STORE" || inst.type == "BRANCH"){
-                    reorder_buffer[rs.dest_rob_entry].ready = true;
-                }
-                if(inst.type != "LOAD") rs.busy = false; 
-
+                finish_execution(rs);
             } else {
                 // Multi-cycle operation
                 rs.executing = true;
-                rs.remaining_cycles = latency - 1;
+                in_flight op = {cycle + latency - 1, &rs};
+                executing_slots.push(op);
             }
-         
         }
+        ready_slots.resize(kept);
+
+        // True dependency: everything still waiting on an operand
+        true_dep_delays += blocked_slots - blocked_issued_this_cycle;
     }
-    void execute(){
-        exec_helper(eff_addr_stations);
-        exec_helper(fp_add_stations);
-        exec_helper(fp_mul_stations);
-        exec_helper(int_stations);
+
+    // Stores and branches are ready to commit once executed, loads go on to
+    // the memory read and everything else queues for the CDB. Loads are the
+    // only ones that hold their station past this point.
+    void finish_execution(reservation_station_slot &rs){
+        int rob_index = rs.dest_rob_entry;
+        const TypeInfo &info = instr_types[instrs.type[rob_index]];
+        instrs.execute_complete_cycle[rob_index] = cycle;
+        progress = true;
+        log_moved(rob_index, EXECUTE_STAGE);
+        if(info.is_load){
+            loads_awaiting_mem.set(rob_index);
+            return;
+        }
+        if(info.writes_result){
+            cdb_arrivals.push_back(rob_index);
+        }
+        else {
+            reorder_buffer[rob_index].ready = true;
+        }
+        free_station(rs);
     }
 
     void mem_read(){
-        //If a store is ready to commit this cycle, block all loads
+        //If a store is ready to commit this cycle, it gets a memory port before any load
         // Store only blocks if it is able to commit this cycle!!!!!
         bool blocking_store = false;
-        if ((rob_start != rob_end || reorder_buffer[rob_start].busy) && !committed_this_cycle && !mem_used){
+        if ((rob_start != rob_end || reorder_buffer[rob_start].busy) && commits_this_cycle < commit_width && mem_accesses < mem_ports){
             reorder_buffer_entry &head = reorder_buffer[rob_start];
             if(head.busy && head.ready){
-                Instruction &head_inst = instructions[head.instruction_id];
-                if(head_inst.type == "STORE" &&
+                if(instr_types[instrs.type[rob_start]].is_store &&
                    head.store_data_dependency == -1 &&
-                   head_inst.execute_complete_cycle != cycle &&
-                   head_inst.mem_read_cycle != cycle &&
-                   head_inst.write_back_cycle != cycle){
+                   instrs.execute_complete_cycle[rob_start] != cycle &&
+                   instrs.mem_read_cycle[rob_start] != cycle &&
+                   instrs.write_back_cycle[rob_start] != cycle){
                     blocking_store = true;
                 }
             }
         }
 
-        // Go through ROB and find loads that can read (1 read per cycle so lots of continues)
-        for(int i = 0; i < reorder_buffer.size(); i++){
-            int rob_index = (rob_start + i) % reorder_buffer.size();
-            if(rob_index == rob_end && !reorder_buffer[rob_index].busy) break;
-            
-            if(!reorder_buffer[rob_index].busy) continue;
+        int load_ports = mem_ports - mem_accesses - (blocking_store ? 1 : 0);
 
-            Instruction &inst = instructions[reorder_buffer[rob_index].instruction_id];
+        // Go through executed loads oldest first and find ones that can read (limited ports so lots of continues)
+        for(int rob_index = loads_awaiting_mem.find(rob_start, 0); rob_index != -1;
+            rob_index = loads_awaiting_mem.find(rob_start, rob_age(rob_index) + 1)){
 
-            if(inst.type != "LOAD" || inst.execute_complete_cycle == -1 || inst.mem_read_cycle != -1 || inst.execute_complete_cycle == cycle) continue;
+            if(instrs.execute_complete_cycle[rob_index] == cycle) continue;
 
-            if(blocking_store){
-                dmc_delays++;
-                continue;
-            }
-            if(mem_used){
+            if(load_ports <= 0){
                 dmc_delays++;
+                log_stage(rob_index, MEM_PORT_WAIT);
                 continue;
             }
 
-            if(check_mem_dependency(reorder_buffer[rob_index].instruction_id)){
+            if(check_mem_dependency(rob_index)){
                 true_dep_delays++;
+                log_stage(rob_index, MEM_DEP_WAIT);
                 continue; 
             }
 
-            
-
-            inst.mem_read_cycle = cycle;
-            mem_used = true;
-
+            instrs.mem_read_cycle[rob_index] = cycle;
+            log_moved(rob_index, MEM_READ_STAGE);
+            mem_accesses++;
+            load_ports--;
+            progress = true;
+            loads_awaiting_mem.clear(rob_index);
 
             //Free loads reservation station since for some reason load is the only RS that doesn't get freed in execute
-            for(auto &rs : eff_addr_stations){
-                if(rs.busy && rs.instruction_id == reorder_buffer[rob_index].instruction_id){
-                    rs.busy = false;
-                }
-            }
-            //return;
+            free_station(station_slots[reorder_buffer[rob_index].station]);
+            cdb_arrivals.push_back(rob_index);
         }
-
-
     }
     
     void write_back(){  
-     
-        int earliest_cycle = INT_MAX;
-        int earliest_ind = -1;
-
-        //iterate through the reorder buffer because the resrvation stations can be cleared after execution
-        for(int i = 0; i < reorder_buffer.size(); i++){
-            int rob_index = (rob_start + i) % reorder_buffer.size();
-            if(rob_index == rob_end && !reorder_buffer[rob_index].busy) break;
-            
-            if(!reorder_buffer[rob_index].busy) continue;
-
-            Instruction &inst = instructions[reorder_buffer[rob_index].instruction_id];
+        //The earliest instrucitons take priority, one per CDB
+        for(int bus = 0; bus < cdb_count; bus++){
+            int earliest_ind = cdb_ready.find(rob_start, 0);
+            if(earliest_ind == -1) break;
+            cdb_ready.clear(earliest_ind);
+
+            instrs.write_back_cycle[earliest_ind] = cycle;
+            progress = true;
+            cdb_writes++;
+            log_moved(earliest_ind, WRITE_BACK_STAGE);
+            reorder_buffer[earliest_ind].ready = true;
+
+            // update dependencies (same as commit)
+            broadcast(earliest_ind);
+        }
 
-            if(inst.type == "STORE" || inst.type == "BRANCH" || inst.write_back_cycle != -1) continue;
-            
-            bool can_wb = false;
-            if(inst.type == "LOAD"){
-                can_wb = (inst.mem_read_cycle != -1 && inst.mem_read_cycle != cycle);
-            }
-            else {
-                can_wb = (inst.execute_complete_cycle != -1 && inst.execute_complete_cycle != cycle);
-            }
+        // results produced this cycle can use the CDB from the next one
+        for(int arrival : cdb_arrivals) cdb_ready.set(arrival);
+        cdb_arrivals.clear();
+    }
 
-            if(can_wb && inst.issue_cycle < earliest_cycle){
-                earliest_cycle = inst.issue_cycle;
-                earliest_ind = rob_index;
+    // Result of ROB entry tag is available: clear it from everything that
+    // registered as waiting on it at issue. Consumers issued after the result
+    // was ready never wait, so both lists are done with once this runs.
+    void broadcast(int tag){
+        for(auto slot : waiting_slots[tag]){
+            if(!slot->busy) continue;
+            bool was_blocked = operands_pending(*slot);
+            if(slot->operand1 == tag) slot->operand1 = -1;
+            if(slot->operand2 == tag) slot->operand2 = -1;
+            if(was_blocked && !operands_pending(*slot)){
+                blocked_slots--;
+                ready_slots.push_back(slot);
             }
-
         }
-        //The earliest instruciton takes priority
-        if(earliest_ind == -1) return;
-        Instruction &earliest = instructions[reorder_buffer[earliest_ind].instruction_id];
-        earliest.write_back_cycle = cycle;
-        reorder_buffer[earliest_ind].ready = true;
-
-        // update dependencies (same as commit)
-        auto update_deps = [&](vector<reservation_station_slot>& rs_pool){
-            for(auto &slot : rs_pool){
-                if(slot.busy){
-                    if(slot.operand1 == earliest_ind) slot.operand1 = -1;
-                    if(slot.operand2 == earliest_ind) slot.operand2 = -1; 
-                }
-            }
-        };
+        waiting_slots[tag].clear();
 
-        for(auto &entry : reorder_buffer){
-            if(entry.busy && entry.store_data_dependency == earliest_ind){
+        for(int store : waiting_stores[tag]){
+            reorder_buffer_entry &entry = reorder_buffer[store];
+            if(entry.busy && entry.store_data_dependency == tag){
                 entry.store_data_dependency = -1;
             }
         }
-
-        update_deps(eff_addr_stations);
-        update_deps(fp_add_stations);
-        update_deps(fp_mul_stations);
-        update_deps(int_stations);
+        waiting_stores[tag].clear();
     }
 
 
+    // commit in order from the ROB head until commit_width is used up or the head isn't ready
     void commit(){
-        if(committed_this_cycle) return;
+        while(commits_this_cycle < commit_width){
+            if(!commit_one()) return;
+        }
+    }
+
+    bool commit_one(){
         if(rob_start == rob_end && !reorder_buffer[rob_start].busy){
-            return;
+            return false;
         } 
 
         //must be ready to commit in the ROB
         reorder_buffer_entry &rob_entry = reorder_buffer[rob_start];
-        if(!rob_entry.busy || !rob_entry.ready) return;
+        if(!rob_entry.busy || !rob_entry.ready) return false;
 
-        Instruction &inst = instructions[rob_entry.instruction_id];
-        if(inst.mem_read_cycle == cycle || inst.write_back_cycle == cycle) return;
+        if(instrs.mem_read_cycle[rob_start] == cycle || instrs.write_back_cycle[rob_start] == cycle) return false;
 
-        if(inst.type == "STORE"){
+        bool is_store = instr_types[instrs.type[rob_start]].is_store;
+        if(is_store){
             if(rob_entry.store_data_dependency != -1){
                 int dep = rob_entry.store_data_dependency;
                 // if dep is read in ROB than we can clear it 
                 if (!reorder_buffer[dep].busy || reorder_buffer[dep].ready){
                     rob_entry.store_data_dependency = -1;
+                    progress = true;
                 }
                 else{
                     true_dep_delays++;
-                    return;
+                    log_stage(rob_start, STORE_DATA_WAIT);
+                    return false;
                 }
             }
 
-            if(mem_used){
+            if(mem_accesses >= mem_ports){
                 dmc_delays++;
-                return;
+                log_stage(rob_start, MEM_PORT_WAIT);
+                return false;
             }
-            mem_used = true;
+            mem_accesses++;
         }
 
 
-        if(inst.execute_complete_cycle == cycle || inst.mem_read_cycle == cycle || inst.write_back_cycle == cycle) return;  
+        if(instrs.execute_complete_cycle[rob_start] == cycle) return false;
 
-        inst.commit_cycle = cycle;
+        instrs.commit_cycle[rob_start] = cycle;
+        progress = true;
 
-        // update corresponding deps in reservation stations 
+        // stores to one address commit in order, so this one heads its chain
+        if(is_store){
+            unordered_map<int, store_chain>::iterator it = inflight_stores.find(instrs.memory_address[rob_start]);
+            if(rob_entry.next_store == -1) inflight_stores.erase(it);
+            else it->second.oldest = rob_entry.next_store;
+        }
 
-        auto update_deps = [&](vector<reservation_station_slot>& rs_pool){
-            for(auto &slot : rs_pool){
-                if(slot.busy){
-                    if(slot.operand1 == rob_start) slot.operand1 = -1;
-                    if(slot.operand2 == rob_start) slot.operand2 = -1;
-                }
-            }
-        };
+        // update corresponding deps in reservation stations and store data
+        broadcast(rob_start);
 
-        update_deps(eff_addr_stations);
-        update_deps(fp_add_stations);
-        update_deps(fp_mul_stations);
-        update_deps(int_stations);
+        print_row(rob_start);
+        if(collect_stats) count_latency(rob_start);
+        log_retire(rob_start);
 
-        // indipendently update the store dep flag
-        for(auto &entry : reorder_buffer){
-            if(entry.busy && entry.store_data_dependency == rob_start){
-                entry.store_data_dependency = -1;
+        int dest_reg = rob_entry.destination_register;
+        if(dest_reg != NO_REG){
+            if(reorder_status[dest_reg] == rob_start){
+                reorder_status[dest_reg] = -1;
             }
         }
 
+        rob_start = (rob_start + 1) % reorder_buffer.size();
+        completed_instructions++;
+        rob_entry.busy = false;
+        commits_this_cycle++;
+        return true;
+    }
 
+};
 
 
-        if(first_output){
-            lines = 0;
-            sprintf(out[lines++],
-                    "                    Pipeline Simulation\n");
-            sprintf(out[lines++],
-                    "-----------------------------------------------------------\n");
-            sprintf(out[lines++],
-                    "                                      Memory Writes\n");
-            sprintf(out[lines++],
-                    "     Instruction      Issues Executes  Read  Result Commits\n");
-            sprintf(out[lines++],
-                    "--------------------- ------ -------- ------ ------ -------\n");
-            first_output = false;
+
+
+// Replays a trace that is already decoded in memory. The vector is only
+// read, so any number of these can share one across threads.
+class VectorTraceSource : public TraceSource {
+    public:
+    VectorTraceSource(const vector<Instruction> &instrs) : instrs(instrs), pos(0) {}
+
+    bool next(Instruction &inst){
+        if(pos == instrs.size()) return false;
+        inst = instrs[pos++];
+        return true;
+    }
+
+    private:
+    const vector<Instruction> &instrs;
+    size_t pos;
+};
+
+// most configurations one sweep may expand to
+#define MAX_SWEEP_CONFIGS 1000000
+
+// a whole item of a sweep value list as a number, blanks around it allowed
+bool parse_sweep_value(const string &text, int &value){
+    const char *start = text.c_str();
+    char *end;
+    errno = 0;
+    long v = strtol(start, &end, 10);
+    if(end == start || errno == ERANGE || v < INT_MIN || v > INT_MAX) return false;
+    while(*end == ' ' || *end == '\t') end++;
+    if(*end != '\0') return false;
+    value = v;
+    return true;
+}
+
+// One config.txt key and the values a sweep tries for it.
+struct SweepParam {
+    const ConfigKey *key;
+    vector<int> values;
+};
+
+// A sweep file uses the config.txt key names with a comma separated list
+// of values and lo..hi ranges, e.g. "reorder: 4..8,16,32". Section lines
+// are allowed but not needed. Each key may appear once; keys it doesn't
+// mention keep their config.txt values. Every value must be one the key
+// allows, and all the combinations together at most MAX_SWEEP_CONFIGS.
+int parse_sweep(const string &filename, vector<SweepParam> &params){
+    ifstream file(filename);
+    if(!file.is_open()){
+        cerr << "can't open sweep file: " << filename << endl;
+        return -1;
+    }
+    string line;
+    long long combinations = 1;
+    while(getline(file, line)){
+        if(line.find_first_not_of(" \t\r\n") == string::npos) continue;
+        if(line == "buffers" || line == "latencies" || line == "widths") continue;
+
+        string key, value;
+        split_config_line(line, key, value);
+        SweepParam param;
+        param.key = find_config_key(key);
+        if(param.key == nullptr){
+            cerr << filename << ": unknown key " << key << endl;
+            return -1;
         }
-        char line_buf[LINESIZE];
-        sprintf(out[lines], "%-21s %6d %3d -%3d ",
-                inst.og_line.c_str(),
-                inst.issue_cycle,
-                inst.execute_start_cycle,
-                inst.execute_complete_cycle);
-        
-        if(inst.mem_read_cycle == -1){
-            sprintf(line_buf, "       ");
-        } else {
-            sprintf(line_buf, "%6d ", inst.mem_read_cycle);
+        for(const SweepParam &other : params){
+            if(other.key == param.key){
+                cerr << filename << ": " << key << " is given twice" << endl;
+                return -1;
+            }
         }
-        strcat(out[lines], line_buf);
-        
-        if(inst.type == "STORE" || inst.type == "BRANCH"){
-            sprintf(line_buf, "       ");
-        } else {
-            sprintf(line_buf, "%6d ", inst.write_back_cycle);
+
+        stringstream values(value);
+        string item;
+        while(getline(values, item, ',')){
+            size_t dots = item.find("..");
+            int lo, hi;
+            bool ok = parse_sweep_value(item.substr(0, dots), lo);
+            if(dots == string::npos) hi = lo;
+            else ok = ok && parse_sweep_value(item.substr(dots + 2), hi);
+            if(!ok || lo < 1 || hi < lo || hi > param.key->max){
+                cerr << filename << ": bad range for " << key << ": " << item << endl;
+                return -1;
+            }
+            if(param.values.size() + (hi - lo + 1LL) > MAX_SWEEP_CONFIGS){
+                cerr << filename << ": too many values for " << key << endl;
+                return -1;
+            }
+            for(int v = lo; v <= hi; v++) param.values.push_back(v);
         }
-        strcat(out[lines], line_buf);
-        
-        sprintf(line_buf, "%7d\n", cycle);
-        strcat(out[lines++], line_buf);
+        if(param.values.empty()){
+            cerr << filename << ": no values for " << key << endl;
+            return -1;
+        }
+        combinations *= param.values.size();
+        if(combinations > MAX_SWEEP_CONFIGS){
+            cerr << filename << ": the sweep has more than " << MAX_SWEEP_CONFIGS << " configurations" << endl;
+            return -1;
+        }
+        params.push_back(param);
+    }
+    return 0;
+}
+
+// the totals a sweep or batch prints for one run
+struct RunSummary {
+    long long instructions;
+    long long cycles;
+    long long rb_delays;
+    long long rs_delays;
+    long long dmc_delays;
+    long long true_dep_delays;
+};
+
+RunSummary summarize(const Simulator &simulator){
+    RunSummary result;
+    result.instructions = simulator.completed_instructions;
+    result.cycles = simulator.cycles();
+    result.rb_delays = simulator.reorder_buffer_delays();
+    result.rs_delays = simulator.reservation_station_delays();
+    result.dmc_delays = simulator.data_memory_conflict_delays();
+    result.true_dep_delays = simulator.true_dependence_delays();
+    return result;
+}
+
+void put_summary_header(ResultWriter &out){
+    out.put("     cycles     IPC   rb delays   rs delays  dmc delays  true dep delays\n");
+}
 
+void put_summary(ResultWriter &out, const RunSummary &result){
+    char ipc[32];
+    snprintf(ipc, sizeof(ipc), "%8.3f", result.cycles ? (double)result.instructions / result.cycles : 0.0);
+    out.put_int(result.cycles, 11);
+    out.put(ipc);
+    out.put_int(result.rb_delays, 12);
+    out.put_int(result.rs_delays, 12);
+    out.put_int(result.dmc_delays, 12);
+    out.put_int(result.true_dep_delays, 17);
+    out.put('\n');
+}
 
-        if(!inst.dest_reg.empty()){
-            if(reorder_status.count(inst.dest_reg) > 0 && reorder_status[inst.dest_reg] == rob_start){
-                reorder_status[inst.dest_reg] = -1;
+// Decode the trace once, then simulate every combination of the swept
+// values on a pool of threads that all replay the same decoded trace.
+// Prints one summary row per configuration, in sweep order.
+int run_sweep(const Config &base, const vector<SweepParam> &params, TraceSource &input, int threads, bool skip_idle_cycles){
+    vector<Config> configs(1, base);
+    for(const SweepParam &param : params){
+        vector<Config> expanded;
+        for(const Config &config : configs){
+            for(int v : param.values){
+                expanded.push_back(config);
+                expanded.back().*param.key->field = v;
             }
         }
+        configs.swap(expanded);
+    }
+    for(const Config &config : configs){
+        const char *problem = check_config(config);
+        if(problem){
+            cerr << "sweep: " << problem << endl;
+            return 1;
+        }
+    }
 
-        rob_start = (rob_start + 1) % reorder_buffer.size();
-        completed_instructions++;
-        rob_entry.busy = false;
-        committed_this_cycle = true;
+    vector<Instruction> trace;
+    Instruction inst;
+    while(input.next(inst)) trace.push_back(inst);
+    if(input.failed()) return 1;
+
+    vector<RunSummary> results(configs.size());
+    atomic<size_t> next_config(0);
+    auto worker = [&](){
+        for(;;){
+            size_t i = next_config++;
+            if(i >= configs.size()) return;
+            VectorTraceSource source(trace);
+            Simulator simulator(configs[i], source, nullptr);
+            simulator.skip_idle_cycles = skip_idle_cycles;
+            simulator.run();
+            results[i] = summarize(simulator);
+        }
+    };
+    if(threads > (int)configs.size()) threads = configs.size();
+    vector<thread> pool;
+    for(int t = 1; t < threads; t++) pool.push_back(thread(worker));
+    worker();
+    for(thread &t : pool) t.join();
+
+    ResultWriter out(stdout);
+    vector<int> widths;
+    for(const SweepParam &param : params){
+        widths.push_back(max(10, (int)strlen(param.key->key) + 1));
+        out.put_right(param.key->key, widths.back());
+    }
+    put_summary_header(out);
+    for(size_t i = 0; i < configs.size(); i++){
+        for(size_t p = 0; p < params.size(); p++){
+            out.put_int(configs[i].*params[p].key->field, widths[p]);
+        }
+        put_summary(out, results[i]);
+    }
+    return 0;
+}
+
+bool has_suffix(const string &s, const char *suffix){
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// A directory means its .dat and .bin files, sorted by name; anything else
+// is a list file with one trace path per line.
+int list_batch_traces(const string &path, vector<string> &traces){
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0){
+        cerr << "can't open batch list: " << path << endl;
+        return -1;
+    }
+    if(S_ISDIR(st.st_mode)){
+        DIR *dir = opendir(path.c_str());
+        if(dir == nullptr){
+            cerr << "can't read directory: " << path << endl;
+            return -1;
+        }
+        while(struct dirent *entry = readdir(dir)){
+            string name = entry->d_name;
+            if(has_suffix(name, ".dat") || has_suffix(name, ".bin")) traces.push_back(path + "/" + name);
+        }
+        closedir(dir);
+        sort(traces.begin(), traces.end());
+        return 0;
+    }
+
+    ifstream list(path);
+    string line;
+    while(getline(list, line)){
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if(!line.empty()) traces.push_back(line);
+    }
+    return 0;
+}
+
+// Simulate every trace with the one config on a pool of worker threads.
+// Each worker keeps a single Simulator and report buffer and resets them
+// between traces. Every trace's report goes to <trace>.out, or to
+// <out_dir>/<trace name>.out (.csv or .ndjson for those formats); stdout
+// gets a summary row per trace and a total. Returns 1 if any trace could
+// not be read or simulated.
+int run_batch(const Config &config, const vector<string> &traces, const string &out_dir, int threads, bool skip_idle_cycles, ReportFormat format){
+    // two traces writing one report would clobber each other, so refuse
+    // those up front (same trace listed twice, or same name in two
+    // directories with --batch-out)
+    vector<string> reports;
+    for(const string &trace : traces){
+        string report = trace + report_suffixes[format];
+        if(!out_dir.empty()) report = out_dir + "/" + report.substr(report.find_last_of('/') + 1);
+        reports.push_back(report);
+    }
+    vector<string> sorted_reports = reports;
+    sort(sorted_reports.begin(), sorted_reports.end());
+    vector<string>::iterator dup = adjacent_find(sorted_reports.begin(), sorted_reports.end());
+    if(dup != sorted_reports.end()){
+        cerr << "batch: more than one trace would write " << *dup << endl;
+        return 1;
+    }
+
+    vector<RunSummary> results(traces.size());
+    vector<char> failed(traces.size(), 0);
+    atomic<size_t> next_trace(0);
+    auto worker = [&](){
+        unique_ptr<Simulator> simulator;
+        ResultWriter writer(nullptr);
+        for(;;){
+            size_t i = next_trace++;
+            if(i >= traces.size()) return;
+            failed[i] = 1;
+            unique_ptr<TraceSource> source(open_trace_file(traces[i], 0));
+            if(!source) continue;
+
+            const string &report = reports[i];
+            FILE *fp = fopen(report.c_str(), "w");
+            if(fp == nullptr){
+                cerr << "can't create report: " << report << endl;
+                continue;
+            }
+            writer.set_file(fp);
+
+            if(!simulator){
+                simulator.reset(new Simulator(config, *source, &writer));
+                simulator->skip_idle_cycles = skip_idle_cycles;
+                simulator->format = format;
+            }
+            else simulator->reset(*source, &writer);
+            simulator->run();
+            writer.set_file(nullptr);
+            fclose(fp);
+
+            results[i] = summarize(*simulator);
+            failed[i] = source->failed();
+        }
+    };
+    if(threads > (int)traces.size()) threads = traces.size();
+    vector<thread> pool;
+    for(int t = 1; t < threads; t++) pool.push_back(thread(worker));
+    worker();
+    for(thread &t : pool) t.join();
+
+    ResultWriter out(stdout);
+    int width = 5;
+    for(const string &name : traces) width = max(width, (int)name.size());
+    RunSummary total = {0, 0, 0, 0, 0, 0};
+    int failures = 0;
+    out.put_left("trace", width);
+    out.put("  instructions");
+    put_summary_header(out);
+    for(size_t i = 0; i < traces.size(); i++){
+        out.put_left(traces[i], width);
+        if(failed[i]){
+            out.put("  failed\n");
+            failures++;
+            continue;
+        }
+        const RunSummary &result = results[i];
+        out.put_int(result.instructions, 14);
+        put_summary(out, result);
+        total.instructions += result.instructions;
+        total.cycles += result.cycles;
+        total.rb_delays += result.rb_delays;
+        total.rs_delays += result.rs_delays;
+        total.dmc_delays += result.dmc_delays;
+        total.true_dep_delays += result.true_dep_delays;
     }
+    out.put_left("total", width);
+    out.put_int(total.instructions, 14);
+    put_summary(out, total);
+    if(failures){
+        out.put_int(failures);
+        out.put(failures == 1 ? " trace failed\n" : " traces failed\n");
+    }
+    return failures ? 1 : 0;
+}
 
+// Synthetic workloads for benchmarking, each stressing one part of the
+// pipeline. Lines use the same layout as the hand-written traces.
+const char *workloads[] = {
+    "fpdiv",    // mostly fp divides: long latencies, fp mul stations fill up
+    "alias",    // loads and stores to four addresses: memory dependences and port conflicts
+    "chain",    // every instruction needs the one before: one long dependence chain
+    "ilp",      // independent streams: sources are never written, addresses never repeat
 };
 
+bool is_workload(const string &kind){
+    for(const char *w : workloads){
+        if(kind == w) return true;
+    }
+    return false;
+}
+
+void put_trace_line(ResultWriter &out, const char *opcode, const char *line){
+    out.put_left(opcode, 7);
+    out.put(line);
+    out.put('\n');
+}
+
+// count lines of the kind of workload, the same every time for a given seed
+void generate_trace(const string &kind, long long count, unsigned seed, ResultWriter &out){
+    mt19937 rng(seed);
+    char line[64];
+    for(long long i = 0; i < count; i++){
+        unsigned r = rng();
+        if(kind == "fpdiv"){
+            static const char *ops[] = {"fdiv.s", "fdiv.s", "fdiv.s", "fdiv.s", "fmul.s", "fadd.s"};
+            snprintf(line, sizeof(line), "f%u,f%u,f%u", r % 32, (r >> 5) % 32, (r >> 10) % 32);
+            put_trace_line(out, ops[(r >> 15) % 6], line);
+        }
+        else if(kind == "alias"){
+            bool fp = (r >> 20) & 1;
+            const char *op = (r >> 21) & 1 ? (fp ? "fsw" : "sw") : (fp ? "flw" : "lw");
+            snprintf(line, sizeof(line), "%c%u,%u(x%u):%u", fp ? 'f' : 'x', r % 8, (r >> 3) % 64, (r >> 9) % 8, (r >> 12) % 4);
+            put_trace_line(out, op, line);
+        }
+        else if(kind == "chain"){
+            switch(i % 4){
+                case 0: put_trace_line(out, "fadd.s", "f1,f1,f2"); break;
+                case 1: put_trace_line(out, "add", "x1,x1,x2"); break;
+                case 2: put_trace_line(out, "fmul.s", "f1,f1,f3"); break;
+                case 3:
+                    snprintf(line, sizeof(line), "x1,8(x1):%u", r % 1024);
+                    put_trace_line(out, "lw", line);
+                    break;
+            }
+        }
+        else {
+            // results go to x8-x31/f8-f31 in turn and sources come from 0-7
+            unsigned dest = 8 + i % 24;
+            switch(r % 4){
+                case 0: snprintf(line, sizeof(line), "f%u,f%u,f%u", dest, (r >> 2) % 8, (r >> 5) % 8); put_trace_line(out, "fadd.s", line); break;
+                case 1: snprintf(line, sizeof(line), "f%u,f%u,f%u", dest, (r >> 2) % 8, (r >> 5) % 8); put_trace_line(out, "fmul.s", line); break;
+                case 2: snprintf(line, sizeof(line), "x%u,x%u,x%u", dest, (r >> 2) % 8, (r >> 5) % 8); put_trace_line(out, "add", line); break;
+                case 3: snprintf(line, sizeof(line), "x%u,0(x%u):%lld", dest, (r >> 2) % 8, i); put_trace_line(out, "lw", line); break;
+            }
+        }
+    }
+}
+
+// pipesim generate <workload> <count> [seed]: a synthetic trace on stdout
+int run_generate(int argc, char **argv){
+    if(argc < 4 || argc > 5 || !is_workload(argv[2]) || atoll(argv[3]) < 1){
+        cerr << "usage: pipesim generate <fpdiv|alias|chain|ilp> <count> [seed]" << endl;
+        return 1;
+    }
+    ResultWriter out(stdout);
+    generate_trace(argv[2], atoll(argv[3]), argc == 5 ? atoi(argv[4]) : 1, out);
+    return 0;
+}
+
+// pipesim bench <dir> <count>...: for every workload and count, generate
+// <dir>/<workload>-<count>.dat if it isn't there yet, then time a separate
+// pipesim process on it (report thrown away, config.txt from the current
+// directory) and print simulated instructions per second and peak RSS.
+int run_bench(int argc, char **argv){
+    if(argc < 4){
+        cerr << "usage: pipesim bench <dir> <count>..." << endl;
+        return 1;
+    }
+    string dir = argv[2];
+    ResultWriter out(stdout);
+    out.put("workload  instructions    seconds         instr/s   peak RSS (MB)\n");
+    out.flush();
+    int failures = 0;
+    for(int a = 3; a < argc; a++){
+        long long count = atoll(argv[a]);
+        if(count < 1){
+            cerr << argv[a] << ": invalid instruction count" << endl;
+            return 1;
+        }
+        for(const char *kind : workloads){
+            string trace = dir + "/" + kind + "-" + argv[a] + ".dat";
+            if(access(trace.c_str(), R_OK) != 0){
+                // written under another name and renamed once complete, so
+                // an interrupted run never leaves a short trace to reuse
+                string partial = trace + ".tmp." + to_string(getpid());
+                FILE *fp = fopen(partial.c_str(), "w");
+                if(fp == nullptr){
+                    cerr << "can't create trace: " << partial << endl;
+                    return 1;
+                }
+                ResultWriter gen(fp);
+                generate_trace(kind, count, 1, gen);
+                gen.flush();
+                bool written = !ferror(fp);
+                if(fclose(fp) != 0 || !written || rename(partial.c_str(), trace.c_str()) != 0){
+                    cerr << "can't write trace: " << trace << endl;
+                    remove(partial.c_str());
+                    return 1;
+                }
+            }
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            pid_t pid = fork();
+            if(pid == 0){
+                int null_fd = ::open("/dev/null", O_WRONLY);
+                dup2(null_fd, 1);
+                // this same binary, however it was started; execlp covers
+                // systems without /proc
+                execl("/proc/self/exe", argv[0], "--trace", trace.c_str(), (char *)nullptr);
+                execlp(argv[0], argv[0], "--trace", trace.c_str(), (char *)nullptr);
+                _exit(127);
+            }
+            int status = 0;
+            struct rusage usage;
+            if(pid < 0 || wait4(pid, &status, 0, &usage) < 0){
+                cerr << "can't run " << argv[0] << endl;
+                return 1;
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            out.put_left(kind, 8);
+            out.put_int(count, 14);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+                out.put("  failed\n");
+                failures++;
+                continue;
+            }
+#ifdef __APPLE__
+            double rss_mb = usage.ru_maxrss / (1024.0 * 1024.0);   // bytes
+#else
+            double rss_mb = usage.ru_maxrss / 1024.0;              // kilobytes
+#endif
+            char numbers[96];
+            snprintf(numbers, sizeof(numbers), "%11.3f %15.0f %15.1f\n", seconds, count / seconds, rss_mb);
+            out.put(numbers);
+            out.flush();
+        }
+    }
+    return failures ? 1 : 0;
+}
 
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "convert") == 0){
+        if(argc != 4){
+            cerr << "usage: pipesim convert <trace.dat> <trace.bin>" << endl;
+            return 1;
+        }
+        return convert_trace(argv[2], argv[3]);
+    }
+    if(argc > 1 && strcmp(argv[1], "generate") == 0) return run_generate(argc, argv);
+    if(argc > 1 && strcmp(argv[1], "bench") == 0) return run_bench(argc, argv);
+
+    // cin gets its own buffer instead of going through stdio, which takes a
+    // lock per character once a decoder thread exists; nothing else here
+    // mixes iostreams with stdio on the same stream
+    ios_base::sync_with_stdio(false);
+
+    bool step_every_cycle = false;
+    string sweep_file;
+    string trace_file;
+    string batch_list;
+    string batch_out;
+    int parse_threads = 0;
+    bool decode_thread = false;
+    bool stats = false;
+    string stats_json;
+    string kanata_file;
+    ReportFormat format = TEXT_REPORT;
+    int threads = thread::hardware_concurrency();
+    if(threads < 1) threads = 1;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "--step") step_every_cycle = true;
+        else if(arg == "--sweep" && i + 1 < argc) sweep_file = argv[++i];
+        else if(arg == "--trace" && i + 1 < argc) trace_file = argv[++i];
+        else if(arg == "--batch" && i + 1 < argc) batch_list = argv[++i];
+        else if(arg == "--batch-out" && i + 1 < argc) batch_out = argv[++i];
+        else if(arg == "--decode-thread") decode_thread = true;
+        else if(arg == "--stats") stats = true;
+        else if(arg == "--kanata" && i + 1 < argc) kanata_file = argv[++i];
+        else if(arg == "--format" && i + 1 < argc){
+            string name = argv[++i];
+            int f = 0;
+            while(f < 3 && name != report_format_names[f]) f++;
+            if(f == 3){
+                cerr << name << ": unknown format, use text, csv or ndjson" << endl;
+                return 1;
+            }
+            format = (ReportFormat)f;
+        }
+        else if(arg == "--stats-json" && i + 1 < argc) stats_json = argv[++i];
+        else if(arg == "--parse-threads" && i + 1 < argc && atoi(argv[i + 1]) > 0) parse_threads = atoi(argv[++i]);
+        else if(arg == "--threads" && i + 1 < argc && atoi(argv[i + 1]) > 0) threads = atoi(argv[++i]);
+        else {
+            cerr << argv[i] << ": invalid command line argument" << endl;
+            return 1;
+        }
+    }
 
+    if(stats && format != TEXT_REPORT){
+        cerr << "--stats only goes with the text report, use --stats-json" << endl;
+        return 1;
+    }
+    // batches and sweeps run many simulations and only print summary rows
+    if((stats || !stats_json.empty()) && (!batch_list.empty() || !sweep_file.empty())){
+        cerr << "--stats and --stats-json only work on a single run, not with --batch or --sweep" << endl;
+        return 1;
+    }
+    if(format != TEXT_REPORT && !sweep_file.empty()){
+        cerr << "--format can't be used with --sweep, which only prints summary rows" << endl;
+        return 1;
+    }
+    if(!kanata_file.empty() && (!batch_list.empty() || !sweep_file.empty())){
+        cerr << "--kanata logs a single run, it can't be used with --batch or --sweep" << endl;
+        return 1;
+    }
 
-int main(){
     Config config;
     if(parse_config("config.txt", config) != 0) {
         cerr << "could not parse config file" << endl;
         return 1;
     }
-    vector<Instruction> instructions = parse_instructions();
-    Simulator simulator(config, instructions);
+
+    if(!batch_list.empty()){
+        vector<string> traces;
+        if(list_batch_traces(batch_list, traces) != 0) return 1;
+        return run_batch(config, traces, batch_out, threads, !step_every_cycle, format);
+    }
+
+    // the trace comes from stdin unless --trace names a file to map
+    if(parse_threads > 0 && trace_file.empty()){
+        cerr << "--parse-threads needs a trace file given with --trace" << endl;
+        return 1;
+    }
+    unique_ptr<TraceSource> trace(trace_file.empty() ? open_trace(cin) : open_trace_file(trace_file, parse_threads));
+    if(!trace) return 1;
+    if(decode_thread) trace.reset(new DecodeThreadTraceSource(trace.release()));
+
+    if(!sweep_file.empty()){
+        vector<SweepParam> params;
+        if(parse_sweep(sweep_file, params) != 0) return 1;
+        return run_sweep(config, params, *trace, threads, !step_every_cycle);
+    }
+    ResultWriter out(stdout);
+    Simulator simulator(config, *trace, &out);
+    simulator.skip_idle_cycles = !step_every_cycle;
+    simulator.format = format;
+    simulator.collect_stats = stats || !stats_json.empty();
+    FILE *kanata_fp = nullptr;
+    unique_ptr<ResultWriter> kanata;
+    if(!kanata_file.empty()){
+        kanata_fp = fopen(kanata_file.c_str(), "w");
+        if(kanata_fp == nullptr){
+            cerr << "can't create kanata log: " << kanata_file << endl;
+            return 1;
+        }
+        kanata.reset(new ResultWriter(kanata_fp));
+        simulator.kanata = kanata.get();
+    }
     simulator.run();
+    if(kanata_fp){
+        kanata.reset();
+        fclose(kanata_fp);
+    }
+    if(stats) simulator.print_stats();
+    if(!stats_json.empty()){
+        FILE *fp = fopen(stats_json.c_str(), "w");
+        if(fp == nullptr){
+            cerr << "can't create stats file: " << stats_json << endl;
+            return 1;
+        }
+        ResultWriter json(fp);
+        simulator.write_stats_json(json);
+        fclose(fp);
+    }
 
-    return 0;
+    return trace->failed() ? 1 : 0;
 }
\ No newline at end of file